@@ -0,0 +1,678 @@
+#include <deal.II/base/function.h>
+#include <deal.II/base/function_parser.h>
+#include <deal.II/base/multithread_info.h>
+#include <deal.II/base/parameter_handler.h>
+#include <deal.II/base/parsed_function.h>
+#include <deal.II/base/parallel.h>
+#include <deal.II/base/quadrature_lib.h>
+#include <deal.II/base/utilities.h>
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_tools.h>
+#include <deal.II/fe/fe_q.h>
+#include <deal.II/grid/grid_generator.h>
+#include <deal.II/grid/grid_tools.h>
+#include <deal.II/grid/tria.h>
+#include <deal.II/lac/dynamic_sparsity_pattern.h>
+#include <deal.II/lac/precondition.h>
+#include <deal.II/lac/solver_bicgstab.h>
+#include <deal.II/lac/solver_cg.h>
+#include <deal.II/lac/solver_control.h>
+#include <deal.II/lac/sparse_ilu.h>
+#include <deal.II/lac/sparse_matrix.h>
+#include <deal.II/lac/sparsity_pattern.h>
+#include <deal.II/lac/vector.h>
+#include <deal.II/numerics/matrix_tools.h>
+#include <deal.II/numerics/vector_tools.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "my_matrix_creator.h"
+#include "my_vector_tools.h"
+#include "extrapolated_field.h"
+#include "sell_c_sigma_matrix.h"
+
+/**
+ * @brief Microbenchmarks of the core kernels, sweeping problem sizes and thread counts.
+ *
+ * @detail
+ *
+ *    Every kernel is run on a globally refined hyper_cube with FE_Q elements,
+ *    and timed as the best of a number of repetitions.
+ *    Throughput is reported per DoF, per solver iteration and DoF, or per point query.
+ *    For the kernels with a simple memory traffic model, i.e. SpMV and the Krylov solves,
+ *    the effective bandwidth is also reported, relative to a STREAM triad measured with the same number of threads.
+ *    The traffic model only counts the matrix-vector products, so it is a lower bound for the solves.
+ *
+ *    Usage: peclet_bench [--dim 2] [--degree 1] [--min-refinement 4] [--max-refinement 8]
+ *                        [--threads 1,2,4] [--repetitions 5] [--kernels spmv,cg_ssor] [--csv results.csv]
+*/
+namespace PecletBench
+{
+    using namespace dealii;
+
+    struct Options
+    {
+        Options()
+            :
+            dim(2),
+            degree(1),
+            min_refinement(4),
+            max_refinement(8),
+            thread_counts({1}),
+            repetitions(5),
+            kernels(),
+            csv_file_path("")
+        {}
+
+        unsigned int dim;
+        unsigned int degree;
+        unsigned int min_refinement;
+        unsigned int max_refinement;
+        std::vector<unsigned int> thread_counts;
+        unsigned int repetitions;
+        std::set<std::string> kernels;
+        std::string csv_file_path;
+    };
+
+    struct Result
+    {
+        std::string kernel;
+        unsigned int dim;
+        unsigned int degree;
+        unsigned int n_cells;
+        unsigned int n_dofs;
+        unsigned int threads;
+        double seconds;
+        double rate;
+        std::string unit;
+        double gigabytes_per_second;
+        double stream_fraction;
+    };
+
+    /*! Parse a comma separated list */
+    std::vector<std::string> split(const std::string &text)
+    {
+        std::vector<std::string> items;
+        std::stringstream stream(text);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            if (item != "")
+            {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    Options parse_options(int argc, char* argv[])
+    {
+        Options options;
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg(argv[i]);
+            if (i + 1 >= argc)
+            {
+                throw std::runtime_error("Missing value for argument: " + arg);
+            }
+            const std::string value(argv[++i]);
+            if (arg == "--dim")
+            {
+                options.dim = Utilities::string_to_int(value);
+            }
+            else if (arg == "--degree")
+            {
+                options.degree = Utilities::string_to_int(value);
+            }
+            else if (arg == "--min-refinement")
+            {
+                options.min_refinement = Utilities::string_to_int(value);
+            }
+            else if (arg == "--max-refinement")
+            {
+                options.max_refinement = Utilities::string_to_int(value);
+            }
+            else if (arg == "--threads")
+            {
+                options.thread_counts.clear();
+                for (auto item : split(value))
+                {
+                    options.thread_counts.push_back(Utilities::string_to_int(item));
+                }
+            }
+            else if (arg == "--repetitions")
+            {
+                options.repetitions = std::max(1, Utilities::string_to_int(value));
+            }
+            else if (arg == "--kernels")
+            {
+                for (auto item : split(value))
+                {
+                    options.kernels.insert(item);
+                }
+            }
+            else if (arg == "--csv")
+            {
+                options.csv_file_path = value;
+            }
+            else
+            {
+                throw std::runtime_error("Unknown argument: " + arg);
+            }
+        }
+        return options;
+    }
+
+    /*! Return the best wall time in seconds over the given number of repetitions */
+    double time_best_of(const unsigned int repetitions, const std::function<void()> &kernel)
+    {
+        double best = std::numeric_limits<double>::max();
+        for (unsigned int r = 0; r < repetitions; ++r)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            kernel();
+            best = std::min(best, std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    /*! Measure the STREAM triad bandwidth in GB/s, with the current thread limit
+
+        The arrays are much larger than the last level cache.
+        As in STREAM, write-allocate traffic is not counted.
+
+    */
+    double measure_stream_triad(const unsigned int repetitions)
+    {
+        const unsigned int n = 1 << 23;
+        std::vector<double> a(n, 0.), b(n, 1.), c(n, 2.);
+        const double scalar = 3.;
+        const double seconds = time_best_of(repetitions, [&]()
+        {
+            parallel::apply_to_subranges(0u, n,
+                [&](const unsigned int begin, const unsigned int end)
+                {
+                    for (unsigned int i = begin; i < end; ++i)
+                    {
+                        a[i] = b[i] + scalar*c[i];
+                    }
+                },
+                4096);
+        });
+        return 3.*sizeof(double)*n/seconds/1.e9;
+    }
+
+    /*! The minimum memory traffic of one SpMV, in bytes
+
+        This reads the values and column indices of every entry, the row starts and the source vector,
+        and writes the destination vector.
+
+    */
+    double spmv_bytes(const SparseMatrix<double> &matrix)
+    {
+        return double(matrix.n_nonzero_elements())*(sizeof(double) + sizeof(unsigned int))
+            + double(matrix.m() + 1)*sizeof(std::size_t)
+            + double(matrix.m() + matrix.n())*sizeof(double);
+    }
+
+    /*! Solve with the given solver and preconditioner, returning the number of iterations */
+    template<typename SolverType, typename PreconditionerType>
+    unsigned int solve(
+        const SparseMatrix<double> &matrix,
+        const Vector<double> &rhs,
+        const PreconditionerType &preconditioner)
+    {
+        SolverControl solver_control(10000, 1.e-8*rhs.l2_norm());
+        SolverType solver(solver_control);
+        Vector<double> solution(rhs.size());
+        try
+        {
+            solver.solve(matrix, solution, rhs, preconditioner);
+        }
+        catch (SolverControl::NoConvergence &)
+        {
+            std::cerr << "Warning: the solver did not converge." << std::endl;
+        }
+        return solver_control.last_step();
+    }
+
+    template<typename PreconditionerType>
+    unsigned int solve(
+        const std::string &solver_name,
+        const SparseMatrix<double> &matrix,
+        const Vector<double> &rhs,
+        const PreconditionerType &preconditioner)
+    {
+        if (solver_name == "cg")
+        {
+            return solve<SolverCG<>>(matrix, rhs, preconditioner);
+        }
+        return solve<SolverBicgstab<>>(matrix, rhs, preconditioner);
+    }
+
+    template<int dim>
+    class Problem
+    {
+    public:
+        Problem(const unsigned int degree, const unsigned int refinement);
+
+        Triangulation<dim> triangulation;
+        FE_Q<dim> fe;
+        DoFHandler<dim> dof_handler;
+        SparsityPattern sparsity_pattern;
+        SparseMatrix<double> mass_matrix;
+        SparseMatrix<double> convection_diffusion_matrix;
+        SparseMatrix<double> diffusion_matrix;
+        SparseMatrix<double> nonsymmetric_system_matrix;
+        SparseMatrix<double> symmetric_system_matrix;
+        Vector<double> field;
+        Vector<double> rhs;
+
+        ConstantFunction<dim> velocity;
+        ConstantFunction<dim> zero_velocity;
+        ConstantFunction<dim> diffusivity;
+        Functions::ParsedFunction<dim> source;
+        ConstantFunction<dim> boundary_flux;
+    };
+
+    template<int dim>
+    Problem<dim>::Problem(const unsigned int degree, const unsigned int refinement)
+        :
+        fe(degree),
+        dof_handler(triangulation),
+        velocity(1., dim),
+        zero_velocity(0., dim),
+        diffusivity(1.e-2),
+        boundary_flux(1.)
+    {
+        GridGenerator::hyper_cube(this->triangulation, 0., 1., true);
+        this->triangulation.refine_global(refinement);
+        this->dof_handler.distribute_dofs(this->fe);
+
+        DynamicSparsityPattern dsp(this->dof_handler.n_dofs());
+        DoFTools::make_sparsity_pattern(this->dof_handler, dsp);
+        this->sparsity_pattern.copy_from(dsp);
+
+        for (SparseMatrix<double> *matrix : {&this->mass_matrix, &this->convection_diffusion_matrix,
+            &this->diffusion_matrix, &this->nonsymmetric_system_matrix, &this->symmetric_system_matrix})
+        {
+            matrix->reinit(this->sparsity_pattern);
+        }
+
+        ParameterHandler prm;
+        Functions::ParsedFunction<dim>::declare_parameters(prm);
+        prm.set("Function expression", "exp(-t)*sin(pi*x)");
+        this->source.parse_parameters(prm);
+
+        const QGauss<dim> quadrature(degree + 1);
+
+        MatrixCreator::create_mass_matrix(this->dof_handler, quadrature, this->mass_matrix);
+
+        MyMatrixCreator::create_convection_diffusion_matrix(this->dof_handler, quadrature,
+            this->convection_diffusion_matrix, &this->diffusivity, &this->velocity);
+
+        MyMatrixCreator::create_convection_diffusion_matrix(this->dof_handler, quadrature,
+            this->diffusion_matrix, &this->diffusivity, &this->zero_velocity);
+
+        /* The same system as a time step of the theta-scheme, with the time step size of the mesh CFL number 1 */
+        const double time_step_size = GridTools::minimal_cell_diameter(this->triangulation);
+
+        this->nonsymmetric_system_matrix.copy_from(this->mass_matrix);
+        this->nonsymmetric_system_matrix.add(time_step_size, this->convection_diffusion_matrix);
+
+        this->symmetric_system_matrix.copy_from(this->mass_matrix);
+        this->symmetric_system_matrix.add(time_step_size, this->diffusion_matrix);
+
+        this->field.reinit(this->dof_handler.n_dofs());
+        VectorTools::interpolate(this->dof_handler, this->source, this->field);
+
+        this->rhs.reinit(this->dof_handler.n_dofs());
+        this->mass_matrix.vmult(this->rhs, this->field);
+    }
+
+    /*! Run every selected kernel on one problem, with the current thread limit */
+    template<int dim>
+    void run_kernels(
+        Problem<dim> &problem,
+        const Options &options,
+        const unsigned int threads,
+        const double stream_gigabytes_per_second,
+        std::vector<Result> &results)
+    {
+        const unsigned int n_dofs = problem.dof_handler.n_dofs();
+
+        auto selected = [&options](const std::string &kernel)
+        {
+            return options.kernels.empty() || (options.kernels.count(kernel) > 0);
+        };
+
+        auto report = [&](const std::string &kernel, const double seconds,
+            const double items, const std::string &unit, const double bytes)
+        {
+            Result result;
+            result.kernel = kernel;
+            result.dim = dim;
+            result.degree = options.degree;
+            result.n_cells = problem.triangulation.n_active_cells();
+            result.n_dofs = n_dofs;
+            result.threads = threads;
+            result.seconds = seconds;
+            result.rate = items/seconds;
+            result.unit = unit;
+            result.gigabytes_per_second = bytes/seconds/1.e9;
+            result.stream_fraction = result.gigabytes_per_second/stream_gigabytes_per_second;
+            results.push_back(result);
+
+            std::cout << std::left << std::setw(32) << kernel << std::right
+                << std::setw(10) << n_dofs
+                << std::setw(4) << threads
+                << std::scientific << std::setprecision(3)
+                << std::setw(12) << seconds
+                << std::setw(12) << result.rate << " " << std::left << std::setw(14) << unit << std::right
+                << std::fixed << std::setprecision(2)
+                << std::setw(8) << result.gigabytes_per_second
+                << std::setw(8) << 100.*result.stream_fraction << std::endl;
+        };
+
+        const QGauss<dim> quadrature(options.degree + 1);
+
+        const QGauss<dim-1> face_quadrature(options.degree + 1);
+
+        if (selected("mass_matrix"))
+        {
+            const double seconds = time_best_of(options.repetitions, [&]()
+            {
+                problem.mass_matrix = 0.;
+                MatrixCreator::create_mass_matrix(problem.dof_handler, quadrature, problem.mass_matrix);
+            });
+            report("mass_matrix", seconds, n_dofs, "DoFs/s", 0.);
+        }
+
+        if (selected("convection_diffusion_matrix"))
+        {
+            const double seconds = time_best_of(options.repetitions, [&]()
+            {
+                problem.convection_diffusion_matrix = 0.;
+                MyMatrixCreator::create_convection_diffusion_matrix(problem.dof_handler, quadrature,
+                    problem.convection_diffusion_matrix, &problem.diffusivity, &problem.velocity);
+            });
+            report("convection_diffusion_matrix", seconds, n_dofs, "DoFs/s", 0.);
+        }
+
+        if (selected("boundary_rhs"))
+        {
+            Vector<double> rhs(n_dofs);
+            const std::set<types::boundary_id> boundary_ids = {0};
+            const double seconds = time_best_of(options.repetitions, [&]()
+            {
+                rhs = 0.;
+                MyVectorTools::my_create_boundary_right_hand_side(problem.dof_handler, face_quadrature,
+                    problem.boundary_flux, rhs, boundary_ids);
+            });
+            report("boundary_rhs", seconds, n_dofs, "DoFs/s", 0.);
+        }
+
+        if (selected("parsed_source_rhs"))
+        {
+            Vector<double> rhs(n_dofs);
+            const double seconds = time_best_of(options.repetitions, [&]()
+            {
+                VectorTools::create_right_hand_side(problem.dof_handler, quadrature, problem.source, rhs);
+            });
+            report("parsed_source_rhs", seconds, n_dofs, "DoFs/s", 0.);
+        }
+
+        if (selected("spmv"))
+        {
+            Vector<double> product(n_dofs);
+            const unsigned int products_per_repetition = 10;
+            const double seconds = time_best_of(options.repetitions, [&]()
+            {
+                for (unsigned int i = 0; i < products_per_repetition; ++i)
+                {
+                    problem.nonsymmetric_system_matrix.vmult(product, problem.field);
+                }
+            })/products_per_repetition;
+            report("spmv", seconds, n_dofs, "DoFs/s", spmv_bytes(problem.nonsymmetric_system_matrix));
+        }
+
+        /* The same product in the SELL-C-sigma format. The traffic of the CSR product is reported,
+        so that the bandwidths of both formats compare the useful work. */
+        if (selected("spmv_sell_c_sigma"))
+        {
+            SellCSigma::Matrix matrix;
+            matrix.reinit(problem.nonsymmetric_system_matrix);
+            Vector<double> product(n_dofs);
+            const unsigned int products_per_repetition = 10;
+            const double seconds = time_best_of(options.repetitions, [&]()
+            {
+                for (unsigned int i = 0; i < products_per_repetition; ++i)
+                {
+                    matrix.vmult(product, problem.field);
+                }
+            })/products_per_repetition;
+            report("spmv_sell_c_sigma", seconds, n_dofs, "DoFs/s", spmv_bytes(problem.nonsymmetric_system_matrix));
+        }
+
+        /* The Krylov solves, with each preconditioner.
+
+        CG is applied to the symmetric system without convection, and BiCGStab to the full system.
+        Preconditioner setup is included in the time, as in Peclet::solve_time_step.
+        Only the matrix-vector products are counted as memory traffic:
+        CG needs one per iteration, and BiCGStab needs two.
+
+        */
+        const std::vector<std::string> preconditioner_names = {"identity", "jacobi", "ssor", "ilu"};
+
+        for (auto preconditioner_name : preconditioner_names)
+        {
+            for (auto solver_name : std::vector<std::string>({"cg", "bicgstab"}))
+            {
+                const std::string kernel = solver_name + "_" + preconditioner_name;
+
+                if (!selected(kernel))
+                {
+                    continue;
+                }
+
+                const SparseMatrix<double> &matrix = (solver_name == "cg") ?
+                    problem.symmetric_system_matrix : problem.nonsymmetric_system_matrix;
+
+                unsigned int iterations = 0;
+
+                const double seconds = time_best_of(options.repetitions, [&]()
+                {
+                    if (preconditioner_name == "identity")
+                    {
+                        PreconditionIdentity preconditioner;
+                        iterations = solve(solver_name, matrix, problem.rhs, preconditioner);
+                    }
+                    else if (preconditioner_name == "jacobi")
+                    {
+                        PreconditionJacobi<> preconditioner;
+                        preconditioner.initialize(matrix, 1.0);
+                        iterations = solve(solver_name, matrix, problem.rhs, preconditioner);
+                    }
+                    else if (preconditioner_name == "ssor")
+                    {
+                        PreconditionSSOR<> preconditioner;
+                        preconditioner.initialize(matrix, 1.0);
+                        iterations = solve(solver_name, matrix, problem.rhs, preconditioner);
+                    }
+                    else if (preconditioner_name == "ilu")
+                    {
+                        SparseILU<double> preconditioner;
+                        preconditioner.initialize(matrix);
+                        iterations = solve(solver_name, matrix, problem.rhs, preconditioner);
+                    }
+                });
+
+                const unsigned int products_per_iteration = (solver_name == "cg") ? 1 : 2;
+
+                report(kernel, seconds, double(n_dofs)*std::max(iterations, 1u), "DoF-its/s",
+                    double(iterations*products_per_iteration)*spmv_bytes(matrix));
+            }
+        }
+
+        /* Point queries of an ExtrapolatedField, at random points of which one in ten is outside of the domain */
+        if (selected("extrapolated_field_value") || selected("extrapolated_field_hinted_value"))
+        {
+            MyFunctions::ExtrapolatedField<dim> extrapolated_field(problem.dof_handler, problem.field);
+
+            const unsigned int n_points = 10000;
+
+            std::mt19937 generator(0);
+
+            std::uniform_real_distribution<double> inside(0., 1.), outside(1., 1.1);
+
+            std::vector<Point<dim>> points(n_points);
+
+            for (unsigned int i = 0; i < n_points; ++i)
+            {
+                for (unsigned int axis = 0; axis < dim; ++axis)
+                {
+                    points[i][axis] = ((i % 10 == 0) && (axis == 0)) ? outside(generator) : inside(generator);
+                }
+            }
+
+            double sum = 0.;
+
+            if (selected("extrapolated_field_value"))
+            {
+                const double seconds = time_best_of(options.repetitions, [&]()
+                {
+                    for (auto &point : points)
+                    {
+                        sum += extrapolated_field.value(point);
+                    }
+                });
+                report("extrapolated_field_value", seconds, n_points, "queries/s", 0.);
+            }
+
+            /* Consecutive points along a line through the domain, so that the hint is usually a neighbor */
+            if (selected("extrapolated_field_hinted_value"))
+            {
+                std::vector<Point<dim>> line_points(n_points);
+
+                for (unsigned int i = 0; i < n_points; ++i)
+                {
+                    for (unsigned int axis = 0; axis < dim; ++axis)
+                    {
+                        line_points[i][axis] = (i + 0.5)/n_points;
+                    }
+                }
+
+                const double seconds = time_best_of(options.repetitions, [&]()
+                {
+                    typename DoFHandler<dim>::active_cell_iterator hint = problem.dof_handler.begin_active();
+                    for (auto &point : line_points)
+                    {
+                        sum += extrapolated_field.value(point, hint);
+                    }
+                });
+                report("extrapolated_field_hinted_value", seconds, n_points, "queries/s", 0.);
+            }
+
+            /* Use the sum, so that the queries are not optimized away. */
+            if (sum == std::numeric_limits<double>::max())
+            {
+                std::cout << sum << std::endl;
+            }
+        }
+    }
+
+    template<int dim>
+    void run(const Options &options)
+    {
+        std::vector<Result> results;
+
+        for (auto threads : options.thread_counts)
+        {
+            MultithreadInfo::set_thread_limit(threads);
+
+            const double stream_gigabytes_per_second = measure_stream_triad(options.repetitions);
+
+            std::cout << "STREAM triad with " << threads << " threads: "
+                << std::fixed << std::setprecision(2) << stream_gigabytes_per_second << " GB/s" << std::endl;
+
+            std::cout << std::left << std::setw(32) << "kernel" << std::right
+                << std::setw(10) << "DoFs" << std::setw(4) << "thr"
+                << std::setw(12) << "seconds" << std::setw(12) << "rate" << " " << std::left << std::setw(14) << "unit"
+                << std::right << std::setw(8) << "GB/s" << std::setw(8) << "%STREAM" << std::endl;
+
+            for (unsigned int refinement = options.min_refinement; refinement <= options.max_refinement; ++refinement)
+            {
+                Problem<dim> problem(options.degree, refinement);
+
+                run_kernels(problem, options, threads, stream_gigabytes_per_second, results);
+            }
+        }
+
+        if (options.csv_file_path != "")
+        {
+            std::ofstream file(options.csv_file_path);
+            if (!file.good())
+            {
+                throw std::runtime_error("Error while opening the file: " + options.csv_file_path);
+            }
+            file << std::setprecision(9);
+            file << "kernel,dim,degree,cells,dofs,threads,seconds,rate,unit,gigabytes_per_second,stream_fraction\n";
+            for (auto &result : results)
+            {
+                file << result.kernel << "," << result.dim << "," << result.degree << ","
+                    << result.n_cells << "," << result.n_dofs << "," << result.threads << ","
+                    << result.seconds << "," << result.rate << "," << result.unit << ","
+                    << result.gigabytes_per_second << "," << result.stream_fraction << "\n";
+            }
+        }
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        const PecletBench::Options options = PecletBench::parse_options(argc, argv);
+
+        switch (options.dim)
+        {
+            case 1:
+                PecletBench::run<1>(options);
+                break;
+            case 2:
+                PecletBench::run<2>(options);
+                break;
+            case 3:
+                PecletBench::run<3>(options);
+                break;
+            default:
+                throw std::runtime_error("The dimension must be 1, 2 or 3.");
+        }
+    }
+    catch (std::exception &exc)
+    {
+        std::cerr << std::endl << std::endl
+              << "----------------------------------------------------"
+              << std::endl;
+        std::cerr << "Exception on processing: " << std::endl << exc.what()
+              << std::endl << "Aborting!" << std::endl
+              << "----------------------------------------------------"
+              << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+"""Strong and weak scaling harness for peclet.
+
+Generates large parameter files from templates of the regression tests,
+runs them across thread counts (and rank counts), and collects the
+instrumentation summaries into strong- and weak-scaling tables with
+parallel efficiency columns.
+
+A parameter file template is copied verbatim, and overrides are appended to it.
+ParameterHandler applies the last value which was set, so the overrides win.
+
+The number of threads is set with the DEAL_II_NUM_THREADS environment variable.
+Ranks greater than one are launched with mpirun. Currently MPI is only used for
+HDF5 output, so every rank solves the whole problem; rank counts are only
+meaningful for distributed modes.
+
+Strong scaling runs every case with the same number of cells on every number of
+threads. Weak scaling grows the number of cells with the number of threads.
+Global refinement can only multiply the cells by 2^dim, so the weak-scaling
+efficiency is normalized by the actual number of DoFs of each run.
+"""
+import argparse
+import csv
+import json
+import math
+import os
+import re
+import subprocess
+import sys
+
+DEFAULT_CASES = ["MMS_2D_VariableVelocity", "Ice_2D_CurvilinearMelting", "Donea_Huerta_5p17_Pe5"]
+
+"""Timers which are summed into the phase columns, by the last name of their path"""
+PHASES = {
+    "setup": ["setup_system"],
+    "assembly": ["assemble_rhs", "assemble_system_matrix", "apply_boundary_values"],
+    "solve": ["preconditioner_setup", "krylov_solve"],
+    "output": ["write_solution", "write_checkpoint"],
+}
+
+
+def read_template(path):
+    with open(path) as file:
+        return file.read()
+
+
+def get_parameter(text, name, default):
+    """Return the last value which the template sets for the parameter, as a string"""
+    matches = re.findall(r"^\s*set\s+" + name + r"\s*=\s*(.*?)\s*$", text, re.MULTILINE)
+    return matches[-1] if matches else default
+
+
+def refinement_for_cells(cells, dim):
+    """Return the number of global refinement cycles of one coarse cell which gives about this many cells"""
+    return max(0, int(round(math.log2(cells)/dim)))
+
+
+def write_case(template, refinement, time_steps, file_path):
+    end_time = float(get_parameter(template, "end_time", "1."))
+    step_size = float(get_parameter(template, "step_size", "0."))
+    if step_size <= 0.:
+        step_size = end_time/2.**float(get_parameter(template, "global_refinement_levels", "4"))
+
+    overrides = """
+# Overrides of the scaling harness
+subsection refinement
+    set initial_global_cycles = {refinement}
+    set initial_boundary_cycles = 0
+end
+subsection time
+    set step_size = {step_size}
+    set end_time = {end_time}
+    set stop_when_steady = false
+end
+subsection output
+    set write_solution_vtk = false
+end
+subsection profiling
+    set enabled = true
+    set summary_file_path = profile.json
+    set summary_format = json
+end
+""".format(refinement=refinement, step_size=repr(step_size), end_time=repr(time_steps*step_size))
+
+    with open(file_path, "w") as file:
+        file.write(template + overrides)
+
+
+"""Rows of the runs which were already done, by directory, since strong and weak scaling can share runs"""
+completed_runs = {}
+
+
+def run_case(args, template, name, refinement, ranks, threads):
+    """Run one case in its own directory, and return a row of the table"""
+    directory = os.path.join(args.output_dir, "{}_r{}_n{}_t{}".format(name, refinement, ranks, threads))
+    if directory in completed_runs:
+        return dict(completed_runs[directory])
+
+    os.makedirs(directory, exist_ok=True)
+    write_case(template, refinement, args.time_steps, os.path.join(directory, "case.prm"))
+
+    command = [os.path.abspath(args.peclet), "case.prm"]
+    if ranks > 1:
+        command = [args.mpirun, "-np", str(ranks)] + command
+
+    environment = dict(os.environ, DEAL_II_NUM_THREADS=str(threads), OMP_NUM_THREADS="1")
+
+    print("Running " + directory, flush=True)
+    with open(os.path.join(directory, "stdout.txt"), "w") as stdout:
+        subprocess.check_call(command, cwd=directory, env=environment, stdout=stdout, stderr=subprocess.STDOUT)
+
+    with open(os.path.join(directory, "profile.json")) as file:
+        profile = json.load(file)
+
+    counters = profile["counters"]
+    timers = profile["timers"]
+
+    def last_counter_value(counter_name):
+        """The setup counters are recorded wherever setup_system is called, so take the largest"""
+        return int(max([counter["last"] for path, counter in counters.items()
+            if path.split("/")[-1] == counter_name] + [0]))
+
+    row = {
+        "case": name,
+        "refinement": refinement,
+        "cells": last_counter_value("n_active_cells"),
+        "dofs": last_counter_value("n_dofs"),
+        "ranks": ranks,
+        "threads": threads,
+        "wall_seconds": timers["run"]["wall_seconds"],
+    }
+    for phase, names in PHASES.items():
+        row[phase + "_seconds"] = sum(timer["wall_seconds"] for path, timer in timers.items()
+            if path.split("/")[-1] in names)
+    completed_runs[directory] = row
+    return dict(row)
+
+
+def add_strong_efficiency(rows):
+    """Speedup and efficiency relative to the run of the same case with the fewest parallel units"""
+    for name in set(row["case"] for row in rows):
+        case_rows = [row for row in rows if row["case"] == name]
+        base = min(case_rows, key=lambda row: row["ranks"]*row["threads"])
+        base_units = base["ranks"]*base["threads"]
+        for row in case_rows:
+            row["speedup"] = base["wall_seconds"]/row["wall_seconds"]
+            row["efficiency"] = row["speedup"]*base_units/(row["ranks"]*row["threads"])
+
+
+def add_weak_efficiency(rows):
+    """Efficiency of the DoF throughput per parallel unit, relative to the run with the fewest parallel units"""
+    def throughput_per_unit(row):
+        return row["dofs"]/row["wall_seconds"]/(row["ranks"]*row["threads"])
+
+    for name in set(row["case"] for row in rows):
+        case_rows = [row for row in rows if row["case"] == name]
+        base = min(case_rows, key=lambda row: row["ranks"]*row["threads"])
+        for row in case_rows:
+            row["efficiency"] = throughput_per_unit(row)/throughput_per_unit(base)
+
+
+def write_table(rows, columns, file_path, title):
+    with open(file_path, "w", newline="") as file:
+        writer = csv.DictWriter(file, fieldnames=columns, extrasaction="ignore")
+        writer.writeheader()
+        writer.writerows(rows)
+
+    print("\n" + title)
+    print(" ".join("{:>16}".format(column) for column in columns))
+    for row in rows:
+        print(" ".join("{:>16.4g}".format(row[column]) if isinstance(row[column], float)
+            else "{:>16}".format(row[column]) for column in columns))
+
+
+def parse_list(text):
+    return [int(item) for item in text.split(",") if item != ""]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--peclet", required=True, help="Path to the peclet executable")
+    parser.add_argument("--templates", required=True, help="Directory containing the template .prm files")
+    parser.add_argument("--output-dir", default="scaling", help="Directory for the generated cases and tables")
+    parser.add_argument("--cases", default=",".join(DEFAULT_CASES), help="Comma separated template names")
+    parser.add_argument("--threads", default="1,2,4,8", help="Comma separated thread counts")
+    parser.add_argument("--ranks", default="1", help="Comma separated MPI rank counts")
+    parser.add_argument("--mpirun", default="mpirun", help="MPI launcher, used for more than one rank")
+    parser.add_argument("--strong-cells", type=int, default=2**18,
+        help="The approximate number of cells of every strong-scaling run")
+    parser.add_argument("--weak-cells-per-unit", type=int, default=2**16,
+        help="The approximate number of cells per thread and rank of the weak-scaling runs")
+    parser.add_argument("--time-steps", type=int, default=10, help="The number of time steps of every run")
+    args = parser.parse_args()
+
+    os.makedirs(args.output_dir, exist_ok=True)
+
+    thread_counts = parse_list(args.threads)
+    rank_counts = parse_list(args.ranks)
+
+    strong_rows = []
+    weak_rows = []
+
+    for name in [case for case in args.cases.split(",") if case != ""]:
+        template = read_template(os.path.join(args.templates, name + ".prm"))
+        dim = int(get_parameter(template, "dim", "1"))
+
+        for ranks in rank_counts:
+            for threads in thread_counts:
+                strong_rows.append(run_case(args, template, name,
+                    refinement_for_cells(args.strong_cells, dim), ranks, threads))
+
+                weak_rows.append(run_case(args, template, name,
+                    refinement_for_cells(args.weak_cells_per_unit*ranks*threads, dim), ranks, threads))
+
+    add_strong_efficiency(strong_rows)
+    add_weak_efficiency(weak_rows)
+
+    phase_columns = [phase + "_seconds" for phase in PHASES]
+
+    write_table(strong_rows,
+        ["case", "cells", "dofs", "ranks", "threads", "wall_seconds"] + phase_columns + ["speedup", "efficiency"],
+        os.path.join(args.output_dir, "strong_scaling.csv"), "Strong scaling")
+
+    write_table(weak_rows,
+        ["case", "cells", "dofs", "ranks", "threads", "wall_seconds"] + phase_columns + ["efficiency"],
+        os.path.join(args.output_dir, "weak_scaling.csv"), "Weak scaling")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,80 @@
+#ifndef _allocation_counting_h_
+#define _allocation_counting_h_
+
+#include <cstdlib>
+#include <new>
+
+#include "instrumentation.h"
+
+/**
+ * @brief Replacements of the global operator new and delete, which count every heap allocation.
+ *
+ * @detail
+ *
+ *    The counts are reported by Instrumentation::add_process_statistics.
+ *    Nothing is counted unless Instrumentation::allocation_counting_enabled() is set, i.e. with profiling enabled,
+ *    so that otherwise an allocation only costs one relaxed atomic load more than std::malloc.
+ *    Counting costs two more relaxed atomic increments per allocation.
+ *
+ *    These are definitions of non-inline functions, so this must be included by exactly one translation unit,
+ *    i.e. main.cc.
+*/
+namespace AllocationCounting
+{
+    inline void *allocate(std::size_t size)
+    {
+        if (Instrumentation::allocation_counting_enabled().load(std::memory_order_relaxed))
+        {
+            Instrumentation::allocation_count().fetch_add(1, std::memory_order_relaxed);
+            Instrumentation::allocated_bytes().fetch_add(size, std::memory_order_relaxed);
+        }
+        return std::malloc((size == 0) ? 1 : size);
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    void *pointer = AllocationCounting::allocate(size);
+    if (pointer == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return AllocationCounting::allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return AllocationCounting::allocate(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+    std::free(pointer);
+}
+
+#endif
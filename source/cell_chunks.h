@@ -0,0 +1,110 @@
+#ifndef _cell_chunks_h_
+#define _cell_chunks_h_
+
+#include <deal.II/base/multithread_info.h>
+#include <deal.II/base/work_stream.h>
+
+#include <utility>
+#include <vector>
+
+#include "tracing.h"
+
+/**
+ * @brief Run WorkStream over chunks of consecutive cells, rather than over single cells.
+ *
+ * @detail
+ *
+ *    Each chunk is one task, which calls the cell worker for each of its cells, and then one call of the
+ *    copier copies all of their local data. So the worker and the copier are each traced as one event per chunk,
+ *    e.g. "assemble_cells" and "copy_local_to_global", which costs nothing per cell and still shows
+ *    how the tasks are spread over the threads.
+*/
+namespace CellChunks
+{
+    /*! The number of cells in a chunk */
+    const unsigned int cells_per_chunk = 32;
+
+    /*! The local data of the cells of one chunk */
+    template <typename CopyData>
+    struct ChunkCopyData
+    {
+        ChunkCopyData(const CopyData &sample)
+            :
+            cells(cells_per_chunk, sample),
+            n_cells(0)
+        {}
+
+        std::vector<CopyData> cells;
+
+        unsigned int n_cells;
+    };
+
+    /*! Call worker for every cell in [begin, end) and copier for the local data of every cell
+
+        This has the semantics of WorkStream::run, including the sequential copier in the order of the cells.
+        The trace event names must be string literals, see Tracing.
+
+    */
+    template <typename Iterator, typename Worker, typename Copier, typename ScratchData, typename CopyData>
+    void run(
+        const Iterator &begin,
+        const Iterator &end,
+        Worker worker,
+        Copier copier,
+        const ScratchData &sample_scratch_data,
+        const CopyData &sample_copy_data,
+        const char *worker_trace_name,
+        const char *copier_trace_name)
+    {
+        typedef std::vector<std::pair<Iterator, Iterator>> Chunks;
+
+        Chunks chunks;
+
+        Iterator chunk_begin = begin;
+
+        while (chunk_begin != end)
+        {
+            Iterator chunk_end = chunk_begin;
+
+            for (unsigned int i = 0; (i < cells_per_chunk) && (chunk_end != end); ++i)
+            {
+                ++chunk_end;
+            }
+
+            chunks.push_back(std::make_pair(chunk_begin, chunk_end));
+
+            chunk_begin = chunk_end;
+        }
+
+        dealii::WorkStream::run(
+            chunks.cbegin(),
+            chunks.cend(),
+            [&worker, worker_trace_name](const typename Chunks::const_iterator &chunk,
+                ScratchData &scratch_data, ChunkCopyData<CopyData> &copy_data)
+            {
+                Tracing::Scope trace (worker_trace_name);
+
+                copy_data.n_cells = 0;
+
+                for (Iterator cell = chunk->first; cell != chunk->second; ++cell, ++copy_data.n_cells)
+                {
+                    worker(cell, scratch_data, copy_data.cells[copy_data.n_cells]);
+                }
+            },
+            [&copier, copier_trace_name](const ChunkCopyData<CopyData> &copy_data)
+            {
+                Tracing::Scope trace (copier_trace_name);
+
+                for (unsigned int i = 0; i < copy_data.n_cells; ++i)
+                {
+                    copier(copy_data.cells[i]);
+                }
+            },
+            sample_scratch_data,
+            ChunkCopyData<CopyData>(sample_copy_data),
+            2*dealii::MultithreadInfo::n_threads(),
+            1);
+    }
+}
+
+#endif
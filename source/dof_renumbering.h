@@ -0,0 +1,321 @@
+#ifndef _dof_renumbering_h_
+#define _dof_renumbering_h_
+
+#include <deal.II/base/function.h>
+#include <deal.II/base/point.h>
+#include <deal.II/base/tensor.h>
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_tools.h>
+#include <deal.II/fe/mapping_q1.h>
+#include <deal.II/lac/dynamic_sparsity_pattern.h>
+#include <deal.II/lac/vector.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Renumber DoFs along the flow of a variable velocity field, or along a space-filling curve.
+ *
+ * @detail
+ *
+ *    Gauss-Seidel and SSOR sweeps converge much faster for convection-dominated problems
+ *    when every unknown is numbered after the unknowns upwind of it,
+ *    since then the lower triangle contains the dominant convective couplings.
+ *    deal.II's DoFRenumbering::downstream only supports one constant direction.
+ *
+ *    Here every pair of coupled DoFs, i.e. every off-diagonal entry of the sparsity pattern,
+ *    is oriented by the mean velocity at their support points, which gives a directed graph.
+ *    The DoFs are then numbered in topological order of this graph.
+ *    Ties are broken, and cycles of recirculating flow are cut, in order of the position
+ *    along the mean flow direction over all DoFs.
+ *
+ *    The hilbert numbering instead orders the DoFs along a Hilbert curve through their support points.
+ *    Points which are close in space then get close numbers at every scale, independently of the
+ *    order in which refinement created the DoFs, so every cache level sees local accesses in the
+ *    matrix-vector products. This is not provided by deal.II 8.5.
+*/
+namespace MyDoFRenumbering
+{
+    using namespace dealii;
+
+    template<int dim>
+    void downwind(DoFHandler<dim> &dof_handler, const Function<dim> &velocity_function)
+    {
+        const types::global_dof_index n_dofs = dof_handler.n_dofs();
+
+        std::vector<Point<dim>> support_points(n_dofs);
+
+        DoFTools::map_dofs_to_support_points(StaticMappingQ1<dim>::mapping, dof_handler, support_points);
+
+        std::vector<Tensor<1,dim>> velocities(n_dofs);
+
+        Tensor<1,dim> mean_velocity;
+
+        Vector<double> velocity(dim);
+
+        for (types::global_dof_index i = 0; i < n_dofs; ++i)
+        {
+            velocity_function.vector_value(support_points[i], velocity);
+
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                velocities[i][axis] = velocity[axis];
+            }
+
+            mean_velocity += velocities[i]/double(n_dofs);
+        }
+
+        /* The position along the mean flow, which orders DoFs that are not coupled by the flow */
+        std::vector<std::pair<double, types::global_dof_index>> keys(n_dofs);
+
+        for (types::global_dof_index i = 0; i < n_dofs; ++i)
+        {
+            keys[i] = std::make_pair(mean_velocity*support_points[i], i);
+        }
+
+        /* Orient every coupling from upwind to downwind */
+        DynamicSparsityPattern dsp(n_dofs);
+
+        DoFTools::make_sparsity_pattern(dof_handler, dsp);
+
+        std::vector<std::vector<types::global_dof_index>> downwind_neighbors(n_dofs);
+
+        std::vector<unsigned int> upwind_count(n_dofs, 0);
+
+        for (types::global_dof_index i = 0; i < n_dofs; ++i)
+        {
+            for (unsigned int k = 0; k < dsp.row_length(i); ++k)
+            {
+                const types::global_dof_index j = dsp.column_number(i, k);
+
+                if (j <= i)
+                {
+                    continue;
+                }
+
+                const Tensor<1,dim> distance = support_points[j] - support_points[i];
+
+                const Tensor<1,dim> edge_velocity = 0.5*(velocities[i] + velocities[j]);
+
+                const double flux = edge_velocity*distance;
+
+                /* Skip crosswind couplings, including where there is no flow */
+                if (std::abs(flux) <= 1.e-12*distance.norm()*edge_velocity.norm())
+                {
+                    continue;
+                }
+
+                const types::global_dof_index upwind = (flux > 0.) ? i : j;
+
+                const types::global_dof_index downwind = (flux > 0.) ? j : i;
+
+                downwind_neighbors[upwind].push_back(downwind);
+
+                ++upwind_count[downwind];
+            }
+        }
+
+        /* Kahn's topological sort, taking the most upstream of the ready DoFs first */
+        typedef std::pair<double, types::global_dof_index> Key;
+
+        std::priority_queue<Key, std::vector<Key>, std::greater<Key>> ready;
+
+        for (types::global_dof_index i = 0; i < n_dofs; ++i)
+        {
+            if (upwind_count[i] == 0)
+            {
+                ready.push(keys[i]);
+            }
+        }
+
+        std::vector<Key> sorted_keys(keys);
+
+        std::sort(sorted_keys.begin(), sorted_keys.end());
+
+        auto next_cycle_breaker = sorted_keys.begin();
+
+        const types::global_dof_index invalid = numbers::invalid_dof_index;
+
+        std::vector<types::global_dof_index> new_numbers(n_dofs, invalid);
+
+        types::global_dof_index next_number = 0;
+
+        while (next_number < n_dofs)
+        {
+            if (ready.empty())
+            { /* Every remaining DoF has an upwind DoF, i.e. the flow recirculates. Cut the cycle. */
+                while (new_numbers[next_cycle_breaker->second] != invalid)
+                {
+                    ++next_cycle_breaker;
+                }
+
+                ready.push(*next_cycle_breaker);
+            }
+
+            const types::global_dof_index i = ready.top().second;
+
+            ready.pop();
+
+            if (new_numbers[i] != invalid)
+            { /* A cycle breaker which was also released by its last upwind neighbor */
+                continue;
+            }
+
+            new_numbers[i] = next_number++;
+
+            for (auto j : downwind_neighbors[i])
+            {
+                if ((--upwind_count[j] == 0) && (new_numbers[j] == invalid))
+                {
+                    ready.push(keys[j]);
+                }
+            }
+        }
+
+        dof_handler.renumber_dofs(new_numbers);
+    }
+
+    /*! Return the index of a point along a Hilbert curve
+
+    The coordinates are integers in [0, 2^bits), and dim*bits must not exceed 64.
+    This is Skilling's transform of the coordinates to the transposed Hilbert index,
+    from "Programming the Hilbert curve", AIP Conference Proceedings 707, 2004,
+    whose bits are then interleaved.
+
+    */
+    template<int dim>
+    std::uint64_t hilbert_index(std::array<std::uint32_t, dim> x, const unsigned int bits)
+    {
+        const std::uint32_t highest_bit = std::uint32_t(1) << (bits - 1);
+
+        /* Inverse undo */
+        for (std::uint32_t q = highest_bit; q > 1; q >>= 1)
+        {
+            const std::uint32_t p = q - 1;
+
+            for (unsigned int i = 0; i < dim; ++i)
+            {
+                if (x[i] & q)
+                {
+                    x[0] ^= p;
+                }
+                else
+                {
+                    const std::uint32_t t = (x[0] ^ x[i]) & p;
+
+                    x[0] ^= t;
+
+                    x[i] ^= t;
+                }
+            }
+        }
+
+        /* Gray encode */
+        for (unsigned int i = 1; i < dim; ++i)
+        {
+            x[i] ^= x[i - 1];
+        }
+
+        std::uint32_t t = 0;
+
+        for (std::uint32_t q = highest_bit; q > 1; q >>= 1)
+        {
+            if (x[dim - 1] & q)
+            {
+                t ^= q - 1;
+            }
+        }
+
+        for (unsigned int i = 0; i < dim; ++i)
+        {
+            x[i] ^= t;
+        }
+
+        std::uint64_t index = 0;
+
+        for (int bit = bits - 1; bit >= 0; --bit)
+        {
+            for (unsigned int i = 0; i < dim; ++i)
+            {
+                index = (index << 1) | ((x[i] >> bit) & 1);
+            }
+        }
+
+        return index;
+    }
+
+    template<int dim>
+    void hilbert(DoFHandler<dim> &dof_handler)
+    {
+        const types::global_dof_index n_dofs = dof_handler.n_dofs();
+
+        std::vector<Point<dim>> support_points(n_dofs);
+
+        DoFTools::map_dofs_to_support_points(StaticMappingQ1<dim>::mapping, dof_handler, support_points);
+
+        if (n_dofs == 0)
+        {
+            return;
+        }
+
+        /* Scale the bounding box uniformly, so that the curve is not distorted on elongated domains */
+        Point<dim> lower = support_points[0];
+
+        Point<dim> upper = support_points[0];
+
+        for (auto &point : support_points)
+        {
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                lower[axis] = std::min(lower[axis], point[axis]);
+
+                upper[axis] = std::max(upper[axis], point[axis]);
+            }
+        }
+
+        double extent = 0.;
+
+        for (unsigned int axis = 0; axis < dim; ++axis)
+        {
+            extent = std::max(extent, upper[axis] - lower[axis]);
+        }
+
+        const unsigned int bits = std::min(32, 64/dim);
+
+        const double scale = (extent > 0.) ? (std::ldexp(1., bits) - 1.)/extent : 0.;
+
+        std::vector<std::pair<std::uint64_t, types::global_dof_index>> keys(n_dofs);
+
+        for (types::global_dof_index i = 0; i < n_dofs; ++i)
+        {
+            std::array<std::uint32_t, dim> coordinates;
+
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                coordinates[axis] = std::uint32_t((support_points[i][axis] - lower[axis])*scale);
+            }
+
+            keys[i] = std::make_pair(hilbert_index<dim>(coordinates, bits), i);
+        }
+
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<types::global_dof_index> new_numbers(n_dofs);
+
+        for (types::global_dof_index k = 0; k < n_dofs; ++k)
+        {
+            new_numbers[keys[k].second] = k;
+        }
+
+        dof_handler.renumber_dofs(new_numbers);
+    }
+
+}
+
+#endif
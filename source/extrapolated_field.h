@@ -2,17 +2,29 @@
 #define _extrapolated_field_h_
 
 #include <deal.II/base/function.h>
-#include <deal.II/grid/grid_tools.h>
-#include <deal.II/numerics/fe_field_function.h>
+#include <deal.II/base/geometry_info.h>
+#include <deal.II/base/smartpointer.h>
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_accessor.h>
+#include <deal.II/fe/fe.h>
+#include <deal.II/fe/mapping_q1.h>
+#include <deal.II/lac/vector.h>
+
+#include "spatial_index.h"
 
 /**
- * @brief Extends the FEFieldFunction with nearest neighbor extrapolation.
+ * @brief Evaluates a finite element field, with nearest neighbor extrapolation.
  *
  * @detail
  *
  *    This is perhaps useful for interpolating the function onto a similar domain
  *    with non-conforming boundaries, e.g. if the domain has only been slightly shifted or rotated.
  *
+ *    Originally this extended the FEFieldFunction, which searches the mesh for every point
+ *    and throws an exception for every point outside of the mesh.
+ *    Instead, a bounding box tree over the active cells and a k-d tree over the boundary vertices
+ *    are built once by the constructor, so that both point location and extrapolation are logarithmic.
+ *
  * @author Alexander Zimmerman 2016
 */
 namespace MyFunctions
@@ -23,67 +35,194 @@ namespace MyFunctions
     class ExtrapolatedField : public Function<dim>
     {
     public:
-        ExtrapolatedField(const DoFHandler<dim> &dof_handler, const Vector<double> &f)
-          : Function<dim>(),
-            field(dof_handler, f),
-            dof_handler_sp(&dof_handler, "ExtrapolatedField")
-        {}
+        ExtrapolatedField(const DoFHandler<dim> &dof_handler, const Vector<double> &field);
         virtual double value(const Point<dim>  &point,
                              const unsigned int component = 0) const;
+        /*! Evaluate the field, first searching the hint cell and its neighbors.
+        
+            The hint is updated to the cell containing the point, so that it can be passed to the next query.
+            This is much faster than value() when consecutive points are close to each other.
+            
+        */
+        double value(const Point<dim> &point,
+                     typename DoFHandler<dim>::active_cell_iterator &hint) const;
+        const DoFHandler<dim> &get_dof_handler() const
+        {
+            return *dof_handler_sp;
+        }
+        const Vector<double> &get_field() const
+        {
+            return *field_sp;
+        }
     private:
-        Functions::FEFieldFunction<dim> field;
         SmartPointer<const DoFHandler<dim>,ExtrapolatedField<dim>> dof_handler_sp;
-        Point<dim> get_nearest_boundary_vertex(const Point<dim> &point) const;
+        SmartPointer<const Vector<double>,ExtrapolatedField<dim>> field_sp;
+        std::vector<typename DoFHandler<dim>::active_cell_iterator> cells;
+        SpatialIndex::BoxTree<dim> cell_tree;
+        std::vector<double> boundary_vertex_values;
+        SpatialIndex::KDTree<dim> boundary_vertex_tree;
+        bool locate(const Point<dim> &point,
+                    typename DoFHandler<dim>::active_cell_iterator &cell,
+                    Point<dim> &unit_point) const;
+        bool is_inside(const Point<dim> &point,
+                       const typename DoFHandler<dim>::active_cell_iterator &cell,
+                       Point<dim> &unit_point) const;
+        double evaluate(const typename DoFHandler<dim>::active_cell_iterator &cell,
+                        const Point<dim> &unit_point) const;
     };
 
+    template<int dim>
+    ExtrapolatedField<dim>::ExtrapolatedField(const DoFHandler<dim> &dof_handler,
+                                              const Vector<double> &field)
+      : Function<dim>(),
+        dof_handler_sp(&dof_handler, "ExtrapolatedField"),
+        field_sp(&field, "ExtrapolatedField")
+    {
+        const double tolerance = 1.e-10;
+        std::vector<SpatialIndex::Box<dim>> boxes;
+        std::vector<Point<dim>> boundary_vertices;
+        std::vector<bool> vertex_visited(dof_handler.get_triangulation().n_vertices(), false);
+        for (auto cell : dof_handler.active_cell_iterators())
+        {
+            SpatialIndex::Box<dim> box(cell->vertex(0), cell->vertex(0));
+            for (unsigned int v=1; v < GeometryInfo<dim>::vertices_per_cell; ++v)
+            {
+                for (unsigned int axis=0; axis < dim; ++axis)
+                {
+                    box.first[axis] = std::min(box.first[axis], cell->vertex(v)[axis]);
+                    box.second[axis] = std::max(box.second[axis], cell->vertex(v)[axis]);
+                }
+            }
+            const double padding = tolerance*cell->diameter();
+            for (unsigned int axis=0; axis < dim; ++axis)
+            {
+                box.first[axis] -= padding;
+                box.second[axis] += padding;
+            }
+            boxes.push_back(box);
+            cells.push_back(cell);
+            if (!cell->at_boundary())
+            {
+                continue;
+            }
+            for (unsigned int f=0; f<GeometryInfo<dim>::faces_per_cell; ++f)
+            {
+                if (!cell->face(f)->at_boundary())
+                {
+                    continue;
+                }
+                for (unsigned int v=0; v < GeometryInfo<dim>::vertices_per_face; ++v)
+                {
+                    const unsigned int cell_vertex = GeometryInfo<dim>::face_to_cell_vertices(f, v);
+                    if (vertex_visited[cell->vertex_index(cell_vertex)])
+                    {
+                        continue;
+                    }
+                    vertex_visited[cell->vertex_index(cell_vertex)] = true;
+                    boundary_vertices.push_back(cell->vertex(cell_vertex));
+                    boundary_vertex_values.push_back(field(cell->vertex_dof_index(cell_vertex, 0)));
+                }
+            }
+        }
+        cell_tree.build(boxes);
+        boundary_vertex_tree.build(boundary_vertices);
+    }
+
     template<int dim>
     double ExtrapolatedField<dim>::value(const Point<dim> &point,
                                          const unsigned int component) const
     {
         Assert(component == 0, ExcInternalError());
-        double val;
-        try 
-        {
-            val = field.value(point, component);
-        }
-        catch (GridTools::ExcPointNotFound<dim>)
+        typename DoFHandler<dim>::active_cell_iterator cell;
+        Point<dim> unit_point;
+        if (locate(point, cell, unit_point))
         {
-            val = field.value(get_nearest_boundary_vertex(point));
+            return evaluate(cell, unit_point);
         }
-        return val;
+        return boundary_vertex_values[boundary_vertex_tree.nearest(point)];
     }
 
-    template <int dim>
-    Point<dim> ExtrapolatedField<dim>::get_nearest_boundary_vertex(const Point<dim> &point) const
+    template<int dim>
+    double ExtrapolatedField<dim>::value(const Point<dim> &point,
+                                         typename DoFHandler<dim>::active_cell_iterator &hint) const
     {
-        double arbitrarily_large_number = 1.e32;
-        double nearest_distance = arbitrarily_large_number;
-        Point<dim> nearest_vertex;
-        for (auto cell : dof_handler_sp->active_cell_iterators())
+        Point<dim> unit_point;
+        if (hint.state() == IteratorState::valid)
         {
-        if (!cell->at_boundary())
+            if (is_inside(point, hint, unit_point))
             {
-                continue;
+                return evaluate(hint, unit_point);
             }
             for (unsigned int f=0; f<GeometryInfo<dim>::faces_per_cell; ++f)
             {
-                if (!cell->face(f)->at_boundary())
+                if (hint->at_boundary(f) || hint->neighbor(f)->has_children())
                 {
                     continue;
                 }
-                for (unsigned int v=0; v < GeometryInfo<dim>::vertices_per_face; ++v)
+                const typename DoFHandler<dim>::active_cell_iterator neighbor = hint->neighbor(f);
+                if (is_inside(point, neighbor, unit_point))
                 {
-                    Point<dim> vertex = cell->face(f)->vertex(v);
-                    double distance = (point - vertex).norm_square();
-                    if (distance < nearest_distance)
-                    {
-                        nearest_vertex = vertex;
-                        nearest_distance = distance;		
-                    }
+                    hint = neighbor;
+                    return evaluate(hint, unit_point);
                 }
             }
         }
-        return nearest_vertex;
+        typename DoFHandler<dim>::active_cell_iterator cell;
+        if (locate(point, cell, unit_point))
+        {
+            hint = cell;
+            return evaluate(cell, unit_point);
+        }
+        return boundary_vertex_values[boundary_vertex_tree.nearest(point)];
+    }
+
+    template <int dim>
+    bool ExtrapolatedField<dim>::locate(const Point<dim> &point,
+                                        typename DoFHandler<dim>::active_cell_iterator &cell,
+                                        Point<dim> &unit_point) const
+    {
+        std::vector<unsigned int> candidates;
+        cell_tree.find(point, candidates);
+        for (auto candidate : candidates)
+        {
+            if (is_inside(point, cells[candidate], unit_point))
+            {
+                cell = cells[candidate];
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <int dim>
+    bool ExtrapolatedField<dim>::is_inside(const Point<dim> &point,
+                                           const typename DoFHandler<dim>::active_cell_iterator &cell,
+                                           Point<dim> &unit_point) const
+    {
+        try
+        {
+            unit_point = StaticMappingQ1<dim>::mapping.transform_real_to_unit_cell(cell, point);
+        }
+        catch (typename Mapping<dim>::ExcTransformationFailed)
+        {
+            return false; // Only happens for badly distorted candidates
+        }
+        return GeometryInfo<dim>::is_inside_unit_cell(unit_point, 1.e-10);
+    }
+
+    template <int dim>
+    double ExtrapolatedField<dim>::evaluate(const typename DoFHandler<dim>::active_cell_iterator &cell,
+                                            const Point<dim> &unit_point) const
+    {
+        const FiniteElement<dim> &fe = dof_handler_sp->get_fe();
+        std::vector<types::global_dof_index> dof_indices(fe.dofs_per_cell);
+        cell->get_dof_indices(dof_indices);
+        double val = 0.;
+        for (unsigned int i=0; i < fe.dofs_per_cell; ++i)
+        {
+            val += (*field_sp)(dof_indices[i])*fe.shape_value(i, unit_point);
+        }
+        return val;
     }
 
 } 
@@ -1,93 +1,657 @@
+#ifndef _fe_field_tools_h_
+#define _fe_field_tools_h_
+
+#include <deal.II/base/geometry_info.h>
 #include <deal.II/grid/tria.h>
+#include <deal.II/grid/tria_accessor.h>
+#include <deal.II/grid/tria_iterator.h>
 #include <deal.II/lac/vector.h>
 #include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_accessor.h>
 #include <deal.II/fe/fe_q.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*! Tools for writing a finite element field to disk, and reading it back, e.g. to initialize a restart.
+
+    A field is written to a single self-describing restart file containing
+        - a 64 byte header with a magic string, format version, dimension, payload size and checksum
+        - the name of the finite element
+        - the coarse mesh, i.e. vertices, cells, material and boundary IDs
+        - the refinement hierarchy, as one refinement case per cell in depth-first order
+        - the manifold IDs of every cell and its faces in depth-first order, so that the caller can attach
+          the manifolds of curved domains to the restored mesh before refining it further
+        - the vertex positions of every active cell, so that curved geometry is restored exactly
+        - the DoF indices of every active cell, so that any DoF numbering is restored exactly
+        - the solution, as a raw block of doubles aligned to 64 bytes
 
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
+    The file is read through a memory map, and the solution block is copied directly into the vector.
+    Loading is still not free: the triangulation is rebuilt by replaying the refinement one level per pass,
+    and the DoFs are distributed and then renumbered to the recorded numbering. This costs about as much as
+    the initial refinement and one DoF distribution of the run which wrote the file, i.e. it is linear in the
+    number of cells, but it avoids parsing text, rebuilding the mesh from solution transfers, or any assembly.
 
+    Files are written to a temporary file and then renamed, so that a reader never sees a partially written file,
+    and concurrent runs only need distinct file paths.
+
+*/
 namespace FEFieldTools
 {
     using namespace dealii;
-    
-    template<int dim>
-    void save_field_parts(
-        Triangulation<dim> &field_tria,
-        DoFHandler<dim> &field_dof_handler,
-        Vector<double> &field_solution)
+
+    const char MAGIC[8] = {'P', 'E', 'C', 'L', 'E', 'T', 'R', 'S'};
+
+    const std::uint32_t VERSION = 2;
+
+    const std::size_t ALIGNMENT = 64;
+
+    /*! The fixed size header at the beginning of every restart file */
+    struct Header
     {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t dim;
+        std::uint64_t payload_size;
+        std::uint64_t checksum;
+        std::uint64_t solution_offset;
+        std::uint64_t n_dofs;
+        char padding[16];
+    };
+
+    static_assert(sizeof(Header) == ALIGNMENT, "The restart file header must fill one aligned block");
+
+    /*! The 64 bit FNV-1a hash, which is used as the payload checksum */
+    inline std::uint64_t checksum(const char *data, const std::size_t size)
+    {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < size; ++i)
         {
-            std::string file_path = "field_solution";
-            std::ofstream file_stream(file_path, std::ios::binary);
-            if (!file_stream.good())
+            hash ^= (unsigned char)data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    /*! Appends plain data to a byte buffer */
+    class Writer
+    {
+    public:
+        std::vector<char> buffer;
+
+        template<typename T>
+        void write(const T &value)
+        {
+            const char *bytes = reinterpret_cast<const char*>(&value);
+            buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+        }
+
+        template<typename T>
+        void write(const T *values, const std::size_t count)
+        {
+            const char *bytes = reinterpret_cast<const char*>(values);
+            buffer.insert(buffer.end(), bytes, bytes + count*sizeof(T));
+        }
+
+        void write(const std::string &string)
+        {
+            write(std::uint64_t(string.size()));
+            write(string.data(), string.size());
+        }
+
+        void align()
+        {
+            buffer.resize(((buffer.size() + ALIGNMENT - 1)/ALIGNMENT)*ALIGNMENT, 0);
+        }
+    };
+
+    /*! Reads plain data from a byte range, checking that no read goes past its end */
+    class Reader
+    {
+    public:
+        Reader(const char *data, const std::size_t size)
+          : data(data), size(size), position(0)
+        {}
+
+        template<typename T>
+        T read()
+        {
+            T value;
+            std::memcpy(&value, this->take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        template<typename T>
+        void read(T *values, const std::size_t count)
+        {
+            std::memcpy(values, this->take(count*sizeof(T)), count*sizeof(T));
+        }
+
+        std::string read_string()
+        {
+            const std::uint64_t length = this->read<std::uint64_t>();
+            return std::string(this->take(length), length);
+        }
+
+        void align()
+        {
+            this->take((ALIGNMENT - position % ALIGNMENT) % ALIGNMENT);
+        }
+
+        const char *take(const std::size_t count)
+        {
+            if (count > size - position)
             {
-                throw std::runtime_error("Error while opening the file: " + file_path);
+                throw std::runtime_error("Unexpected end of restart data");
             }
-            boost::archive::binary_oarchive archive(file_stream);
-            archive << field_solution;
+            const char *pointer = data + position;
+            position += count;
+            return pointer;
         }
+
+    private:
+        const char *data;
+        std::size_t size;
+        std::size_t position;
+    };
+
+    /*! A read-only memory map of a whole file, which is unmapped when this goes out of scope */
+    class MappedFile
+    {
+    public:
+        MappedFile(const std::string file_path)
+          : data(nullptr), size(0)
         {
-            std::string file_path = "field_dof_handler";
-            std::ofstream file_stream(file_path, std::ios::binary);
-            if (!file_stream.good())
+            const int file_descriptor = open(file_path.c_str(), O_RDONLY);
+            if (file_descriptor < 0)
             {
                 throw std::runtime_error("Error while opening the file: " + file_path);
             }
-            boost::archive::binary_oarchive archive(file_stream);
-            archive << field_dof_handler;
+            struct stat file_status;
+            if ((fstat(file_descriptor, &file_status) != 0) || (file_status.st_size == 0))
+            {
+                close(file_descriptor);
+                throw std::runtime_error("Error while reading the file: " + file_path);
+            }
+            size = file_status.st_size;
+            void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+            close(file_descriptor);
+            if (map == MAP_FAILED)
+            {
+                throw std::runtime_error("Error while mapping the file: " + file_path);
+            }
+            data = static_cast<const char*>(map);
+        }
+
+        ~MappedFile()
+        {
+            munmap(const_cast<char*>(data), size);
         }
+
+        const char *data;
+        std::size_t size;
+    };
+
+    /*! Write the header and payload to file_path, atomically replacing any existing file
+    
+        The magic string distinguishes different kinds of files which share this container format.
+    
+    */
+    inline void write_file(const std::string file_path, Header header, const Writer &payload,
+                           const char *magic = MAGIC)
+    {
+        std::memcpy(header.magic, magic, sizeof(MAGIC));
+        header.version = VERSION;
+        header.payload_size = payload.buffer.size();
+        header.checksum = checksum(payload.buffer.data(), payload.buffer.size());
+        std::memset(header.padding, 0, sizeof(header.padding));
+
+        const std::string temporary_file_path = file_path + ".tmp." + std::to_string(getpid());
         {
-            std::string file_path = "field_triangulation";
-            std::ofstream file_stream(file_path, std::ios::binary);
+            std::ofstream file_stream(temporary_file_path, std::ios::binary);
             if (!file_stream.good())
             {
-                throw std::runtime_error("Error while opening the file: " + file_path);
+                throw std::runtime_error("Error while opening the file: " + temporary_file_path);
+            }
+            file_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file_stream.write(payload.buffer.data(), payload.buffer.size());
+            if (!file_stream.good())
+            {
+                throw std::runtime_error("Error while writing the file: " + temporary_file_path);
             }
-            boost::archive::binary_oarchive archive(file_stream);
-            archive << field_tria;
+        }
+        if (std::rename(temporary_file_path.c_str(), file_path.c_str()) != 0)
+        {
+            std::remove(temporary_file_path.c_str());
+            throw std::runtime_error("Error while renaming the file: " + temporary_file_path);
         }
     }
+
+    /*! Validate the header and checksum of a mapped file, and return the header */
+    inline Header read_header(const MappedFile &file, const std::string file_path, const unsigned int dim,
+                              const char *magic = MAGIC)
+    {
+        if (file.size < sizeof(Header))
+        {
+            throw std::runtime_error("Not a restart file: " + file_path);
+        }
+        Header header;
+        std::memcpy(&header, file.data, sizeof(Header));
+        if (std::memcmp(header.magic, magic, sizeof(MAGIC)) != 0)
+        {
+            throw std::runtime_error("Unexpected file type: " + file_path);
+        }
+        if (header.version != VERSION)
+        {
+            throw std::runtime_error("Unsupported restart file version " + std::to_string(header.version)
+                + " in " + file_path);
+        }
+        if (header.dim != dim)
+        {
+            throw std::runtime_error("The restart file " + file_path + " has dimension "
+                + std::to_string(header.dim) + " instead of " + std::to_string(dim));
+        }
+        if ((header.payload_size != file.size - sizeof(Header)) ||
+            (header.checksum != checksum(file.data + sizeof(Header), header.payload_size)))
+        {
+            throw std::runtime_error("The restart file " + file_path + " is corrupt");
+        }
+        return header;
+    }
+
+    /*! Visit all cells in depth-first order, starting from each coarse cell */
+    template<typename CellIterator, typename Visitor>
+    void visit_depth_first(const CellIterator &cell, Visitor &visitor)
+    {
+        if (!visitor(cell) || !cell->has_children())
+        {
+            return;
+        }
+        for (unsigned int c = 0; c < cell->n_children(); ++c)
+        {
+            visit_depth_first(CellIterator(cell->child(c)), visitor);
+        }
+    }
+
+    /*! Append the manifold IDs of the faces of a cell */
     template<int dim>
-    void load_field_parts(
-        Triangulation<dim> &field_tria,
-        DoFHandler<dim> &field_dof_handler,
-        Vector<double> &field_solution,
-        FE_Q<dim> &fe)
+    void append_face_manifold_ids(
+        const TriaIterator<CellAccessor<dim, dim>> &cell,
+        std::vector<std::uint32_t> &manifold_ids)
     {
+        for (unsigned int f = 0; f < GeometryInfo<dim>::faces_per_cell; ++f)
         {
-            std::string file_path = "field_triangulation";
-            std::ifstream file_stream(file_path, std::ios::binary);
-            if (!file_stream.good())
+            manifold_ids.push_back(std::uint32_t(cell->face(f)->manifold_id()));
+        }
+    }
+
+    /*! In 1D the faces are vertices, which have no manifold IDs. */
+    inline void append_face_manifold_ids(
+        const TriaIterator<CellAccessor<1, 1>> &,
+        std::vector<std::uint32_t> &)
+    {}
+
+    /*! Set the manifold IDs of the faces of a cell */
+    template<int dim>
+    void restore_face_manifold_ids(
+        const TriaIterator<CellAccessor<dim, dim>> &cell,
+        const std::vector<std::uint32_t> &manifold_ids,
+        std::size_t &position)
+    {
+        for (unsigned int f = 0; f < GeometryInfo<dim>::faces_per_cell; ++f)
+        {
+            cell->face(f)->set_manifold_id(types::manifold_id(manifold_ids.at(position++)));
+        }
+    }
+
+    inline void restore_face_manifold_ids(
+        const TriaIterator<CellAccessor<1, 1>> &,
+        const std::vector<std::uint32_t> &,
+        std::size_t &)
+    {}
+
+    /*! Write the coarse mesh and the refinement hierarchy */
+    template<int dim>
+    void write_mesh(Writer &writer, const Triangulation<dim> &tria)
+    {
+        std::vector<unsigned int> coarse_vertex_indices(tria.n_vertices(), numbers::invalid_unsigned_int);
+        std::vector<Point<dim>> coarse_vertices;
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+        {
+            for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
             {
-                throw std::runtime_error("Error while opening the file: " + file_path);
+                if (coarse_vertex_indices[cell->vertex_index(v)] == numbers::invalid_unsigned_int)
+                {
+                    coarse_vertex_indices[cell->vertex_index(v)] = coarse_vertices.size();
+                    coarse_vertices.push_back(tria.get_vertices()[cell->vertex_index(v)]);
+                }
             }
-            boost::archive::binary_iarchive archive(file_stream);
-            archive >> field_tria;
         }
-        field_dof_handler.distribute_dofs(fe);
+        writer.write(std::uint64_t(coarse_vertices.size()));
+        for (auto &vertex : coarse_vertices)
         {
-            std::string file_path = "field_dof_handler";
-            std::ifstream file_stream(file_path, std::ios::binary);
-            if (!file_stream.good())
+            for (unsigned int axis = 0; axis < dim; ++axis)
             {
-                throw std::runtime_error("Error while opening the file: " + file_path);
+                writer.write(vertex[axis]);
             }
-            boost::archive::binary_iarchive archive(file_stream);
-            archive >> field_dof_handler;
         }
+
+        writer.write(std::uint64_t(tria.n_cells(0)));
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
         {
-            std::string file_path = "field_solution";
-            std::ifstream file_stream(file_path, std::ios::binary);
-            if (!file_stream.good())
+            for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
             {
-                throw std::runtime_error("Error while opening the file: " + file_path);
+                writer.write(std::uint32_t(coarse_vertex_indices[cell->vertex_index(v)]));
+            }
+            writer.write(std::uint32_t(cell->material_id()));
+            for (unsigned int f = 0; f < GeometryInfo<dim>::faces_per_cell; ++f)
+            {
+                writer.write(std::uint32_t(cell->face(f)->at_boundary() ?
+                    cell->face(f)->boundary_id() : numbers::internal_face_boundary_id));
+            }
+        }
+
+        std::vector<std::uint8_t> refinement_cases;
+        auto record = [&refinement_cases](const typename Triangulation<dim>::cell_iterator &cell)
+        {
+            refinement_cases.push_back(std::uint8_t(cell->refinement_case()));
+            return true;
+        };
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+        {
+            visit_depth_first(cell, record);
+        }
+        writer.write(std::uint64_t(refinement_cases.size()));
+        writer.write(refinement_cases.data(), refinement_cases.size());
+
+        /* Children inherit the manifold IDs of their parents, but these may have been changed since,
+           so the IDs of every cell and face are recorded. */
+        std::vector<std::uint32_t> manifold_ids;
+        auto record_manifold_ids = [&manifold_ids](const typename Triangulation<dim>::cell_iterator &cell)
+        {
+            manifold_ids.push_back(std::uint32_t(cell->manifold_id()));
+            append_face_manifold_ids(cell, manifold_ids);
+            return true;
+        };
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+        {
+            visit_depth_first(cell, record_manifold_ids);
+        }
+        writer.write(std::uint64_t(manifold_ids.size()));
+        writer.write(manifold_ids.data(), manifold_ids.size());
+
+        std::vector<double> active_vertices;
+        auto record_vertices = [&active_vertices](const typename Triangulation<dim>::cell_iterator &cell)
+        {
+            if (!cell->has_children())
+            {
+                for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
+                {
+                    for (unsigned int axis = 0; axis < dim; ++axis)
+                    {
+                        active_vertices.push_back(cell->vertex(v)[axis]);
+                    }
+                }
+            }
+            return true;
+        };
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+        {
+            visit_depth_first(cell, record_vertices);
+        }
+        writer.write(std::uint64_t(active_vertices.size()));
+        writer.write(active_vertices.data(), active_vertices.size());
+    }
+
+    /*! Read the coarse mesh and replay the refinement hierarchy */
+    template<int dim>
+    void read_mesh(Reader &reader, Triangulation<dim> &tria)
+    {
+        std::vector<Point<dim>> coarse_vertices(reader.read<std::uint64_t>());
+        for (auto &vertex : coarse_vertices)
+        {
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                vertex[axis] = reader.read<double>();
+            }
+        }
+
+        std::vector<CellData<dim>> coarse_cells(reader.read<std::uint64_t>());
+        std::vector<std::uint32_t> coarse_boundary_ids(
+            coarse_cells.size()*GeometryInfo<dim>::faces_per_cell);
+        for (unsigned int c = 0; c < coarse_cells.size(); ++c)
+        {
+            for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
+            {
+                coarse_cells[c].vertices[v] = reader.read<std::uint32_t>();
+            }
+            coarse_cells[c].material_id = reader.read<std::uint32_t>();
+            reader.read(&coarse_boundary_ids[c*GeometryInfo<dim>::faces_per_cell],
+                GeometryInfo<dim>::faces_per_cell);
+        }
+
+        if (tria.n_levels() > 0)
+        {
+            tria.clear();
+        }
+        tria.create_triangulation(coarse_vertices, coarse_cells, SubCellData());
+        unsigned int c = 0;
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell, ++c)
+        {
+            for (unsigned int f = 0; f < GeometryInfo<dim>::faces_per_cell; ++f)
+            {
+                if (cell->face(f)->at_boundary())
+                {
+                    cell->face(f)->set_boundary_id(
+                        coarse_boundary_ids[c*GeometryInfo<dim>::faces_per_cell + f]);
+                }
+            }
+        }
+
+        std::vector<std::uint8_t> refinement_cases(reader.read<std::uint64_t>());
+        reader.read(refinement_cases.data(), refinement_cases.size());
+
+        /* Replay one level per pass. Cells which are not yet refined are flagged, and their recorded
+           sub-trees are skipped, since they will only be visited in the next pass. */
+        bool flagged = true;
+        while (flagged)
+        {
+            flagged = false;
+            std::size_t position = 0;
+            std::function<void(const typename Triangulation<dim>::cell_iterator &)> replay;
+            std::function<void(const unsigned int)> skip = [&](const unsigned int n_children)
+            {
+                for (unsigned int i = 0; i < n_children; ++i)
+                {
+                    const RefinementCase<dim> refinement_case(refinement_cases.at(position++));
+                    skip(GeometryInfo<dim>::n_children(refinement_case));
+                }
+            };
+            replay = [&](const typename Triangulation<dim>::cell_iterator &cell)
+            {
+                const RefinementCase<dim> refinement_case(refinement_cases.at(position++));
+                if (refinement_case == RefinementCase<dim>::no_refinement)
+                {
+                    return;
+                }
+                if (cell->has_children())
+                {
+                    for (unsigned int child = 0; child < cell->n_children(); ++child)
+                    {
+                        replay(cell->child(child));
+                    }
+                }
+                else
+                {
+                    cell->set_refine_flag(refinement_case);
+                    flagged = true;
+                    skip(GeometryInfo<dim>::n_children(refinement_case));
+                }
+            };
+            for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+            {
+                replay(cell);
             }
-            boost::archive::binary_iarchive archive(file_stream);
-            archive >> field_solution;
+            if (flagged)
+            {
+                tria.execute_coarsening_and_refinement();
+            }
+        }
+
+        std::vector<std::uint32_t> manifold_ids(reader.read<std::uint64_t>());
+        reader.read(manifold_ids.data(), manifold_ids.size());
+        std::size_t manifold_id_position = 0;
+        auto restore_manifold_ids = [&](const typename Triangulation<dim>::cell_iterator &cell)
+        {
+            cell->set_manifold_id(types::manifold_id(manifold_ids.at(manifold_id_position++)));
+            restore_face_manifold_ids(cell, manifold_ids, manifold_id_position);
+            return true;
+        };
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+        {
+            visit_depth_first(cell, restore_manifold_ids);
+        }
+
+        std::vector<double> active_vertices(reader.read<std::uint64_t>());
+        reader.read(active_vertices.data(), active_vertices.size());
+        std::size_t position = 0;
+        auto restore_vertices = [&](const typename Triangulation<dim>::cell_iterator &cell)
+        {
+            if (!cell->has_children())
+            {
+                for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
+                {
+                    for (unsigned int axis = 0; axis < dim; ++axis)
+                    {
+                        cell->vertex(v)[axis] = active_vertices.at(position++);
+                    }
+                }
+            }
+            return true;
+        };
+        for (auto cell = tria.begin(0); cell != tria.end(0); ++cell)
+        {
+            visit_depth_first(cell, restore_vertices);
         }
     }
+
+    /*! Write the DoF indices of every active cell in depth-first order */
+    template<int dim>
+    void write_dof_indices(Writer &writer, const DoFHandler<dim> &dof_handler)
+    {
+        const unsigned int dofs_per_cell = dof_handler.get_fe().dofs_per_cell;
+        std::vector<types::global_dof_index> cell_dof_indices(dofs_per_cell);
+        std::vector<std::uint64_t> dof_indices;
+        auto record = [&](const typename DoFHandler<dim>::cell_iterator &cell)
+        {
+            if (!cell->has_children())
+            {
+                cell->get_dof_indices(cell_dof_indices);
+                dof_indices.insert(dof_indices.end(), cell_dof_indices.begin(), cell_dof_indices.end());
+            }
+            return true;
+        };
+        for (auto cell = dof_handler.begin(0); cell != dof_handler.end(0); ++cell)
+        {
+            visit_depth_first(cell, record);
+        }
+        writer.write(std::uint64_t(dof_indices.size()));
+        writer.write(dof_indices.data(), dof_indices.size());
+    }
+
+    /*! Distribute DoFs and renumber them to the recorded DoF indices */
+    template<int dim>
+    void read_dof_indices(Reader &reader, DoFHandler<dim> &dof_handler, const FiniteElement<dim> &fe)
+    {
+        dof_handler.distribute_dofs(fe);
+        std::vector<std::uint64_t> dof_indices(reader.read<std::uint64_t>());
+        reader.read(dof_indices.data(), dof_indices.size());
+        std::vector<types::global_dof_index> cell_dof_indices(fe.dofs_per_cell);
+        std::vector<types::global_dof_index> new_numbers(dof_handler.n_dofs());
+        std::size_t position = 0;
+        auto record = [&](const typename DoFHandler<dim>::cell_iterator &cell)
+        {
+            if (!cell->has_children())
+            {
+                cell->get_dof_indices(cell_dof_indices);
+                for (auto dof_index : cell_dof_indices)
+                {
+                    new_numbers[dof_index] = dof_indices.at(position++);
+                }
+            }
+            return true;
+        };
+        for (auto cell = dof_handler.begin(0); cell != dof_handler.end(0); ++cell)
+        {
+            visit_depth_first(cell, record);
+        }
+        dof_handler.renumber_dofs(new_numbers);
+    }
+
+    /*! Write a field to a restart file. */
+    template<int dim>
+    void save_field(
+        const std::string file_path,
+        const Triangulation<dim> &field_tria,
+        const DoFHandler<dim> &field_dof_handler,
+        const Vector<double> &field_solution)
+    {
+        Writer payload;
+        payload.write(field_dof_handler.get_fe().get_name());
+        write_mesh(payload, field_tria);
+        write_dof_indices(payload, field_dof_handler);
+        payload.align();
+
+        Header header;
+        header.dim = dim;
+        header.solution_offset = sizeof(Header) + payload.buffer.size();
+        header.n_dofs = field_solution.size();
+        payload.write(field_solution.begin(), field_solution.size());
+
+        write_file(file_path, header, payload);
+    }
+
+    /*! Read a field from a restart file. */
+    template<int dim>
+    void load_field(
+        const std::string file_path,
+        Triangulation<dim> &field_tria,
+        DoFHandler<dim> &field_dof_handler,
+        Vector<double> &field_solution,
+        const FE_Q<dim> &fe)
+    {
+        MappedFile file(file_path);
+        Header header = read_header(file, file_path, dim);
+        Reader reader(file.data + sizeof(Header), header.payload_size);
+
+        const std::string fe_name = reader.read_string();
+        if (fe_name != fe.get_name())
+        {
+            throw std::runtime_error("The restart file " + file_path + " uses " + fe_name
+                + " instead of " + fe.get_name());
+        }
+        read_mesh(reader, field_tria);
+        read_dof_indices(reader, field_dof_handler, fe);
+        if (field_dof_handler.n_dofs() != header.n_dofs)
+        {
+            throw std::runtime_error("The restart file " + file_path + " is inconsistent");
+        }
+
+        field_solution.reinit(header.n_dofs);
+        reader.align();
+        reader.read(field_solution.begin(), header.n_dofs);
+    }
 }
-  
\ No newline at end of file
+
+#endif
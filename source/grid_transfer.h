@@ -0,0 +1,162 @@
+#ifndef _grid_transfer_h_
+#define _grid_transfer_h_
+
+#include <deal.II/base/parallel.h>
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_accessor.h>
+#include <deal.II/dofs/dof_tools.h>
+#include <deal.II/fe/mapping_q1.h>
+#include <deal.II/lac/vector.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "extrapolated_field.h"
+#include "tracing.h"
+
+/**
+ * @brief Transfers a finite element field between non-matching grids.
+ *
+ * @detail
+ *
+ *    VectorTools::interpolate evaluates the source field at one target support point at a time,
+ *    searching the source mesh from scratch for every point.
+ *    Here all target support points are gathered at once and sorted along a Morton (Z-order) curve,
+ *    so that consecutive points are close to each other. Every thread then walks the source mesh
+ *    with the cell containing the previous point as the hint for the next point.
+*/
+namespace GridTransfer
+{
+    using namespace dealii;
+
+    /*! Compute the Morton code of a point, relative to the bounding box [lower, upper] */
+    template<int dim>
+    std::uint64_t morton_code(const Point<dim> &point,
+                              const Point<dim> &lower,
+                              const Point<dim> &upper)
+    {
+        const unsigned int bits = 63/dim;
+        const std::uint64_t max_coordinate = (std::uint64_t(1) << bits) - 1;
+        std::uint64_t coordinates[dim];
+        for (unsigned int axis = 0; axis < dim; ++axis)
+        {
+            const double extent = upper[axis] - lower[axis];
+            const double scaled = (extent > 0.) ? (point[axis] - lower[axis])/extent : 0.;
+            coordinates[axis] = std::min(max_coordinate,
+                std::uint64_t(std::max(0., scaled)*max_coordinate));
+        }
+        std::uint64_t code = 0;
+        for (int bit = bits - 1; bit >= 0; --bit)
+        {
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                code = (code << 1) | ((coordinates[axis] >> bit) & 1);
+            }
+        }
+        return code;
+    }
+
+    /*! Check if two DoF handlers have identical meshes and DoF numberings.
+
+        In this case a field on one of them can be copied directly to the other.
+
+    */
+    template<int dim>
+    bool have_identical_dofs(const DoFHandler<dim> &a, const DoFHandler<dim> &b)
+    {
+        if ((a.n_dofs() != b.n_dofs()) ||
+            (a.get_fe().get_name() != b.get_fe().get_name()) ||
+            (a.get_triangulation().n_active_cells() != b.get_triangulation().n_active_cells()))
+        {
+            return false;
+        }
+        const double tolerance = 1.e-12;
+        std::vector<types::global_dof_index> a_dof_indices(a.get_fe().dofs_per_cell),
+            b_dof_indices(b.get_fe().dofs_per_cell);
+        auto b_cell = b.begin_active();
+        for (auto a_cell = a.begin_active(); a_cell != a.end(); ++a_cell, ++b_cell)
+        {
+            for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
+            {
+                if (a_cell->vertex(v).distance(b_cell->vertex(v)) > tolerance*a_cell->diameter())
+                {
+                    return false;
+                }
+            }
+            a_cell->get_dof_indices(a_dof_indices);
+            b_cell->get_dof_indices(b_dof_indices);
+            if (a_dof_indices != b_dof_indices)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*! Interpolate the source field onto the target DoF handler.
+
+        If the source and target have identical meshes and DoF numberings, e.g. when restarting from a field
+        which was saved with FEFieldTools::save_field without any further refinement,
+        then the source vector is copied without any interpolation.
+
+        Points outside of the source mesh are extrapolated, see MyFunctions::ExtrapolatedField.
+
+    */
+    template<int dim>
+    void interpolate(const MyFunctions::ExtrapolatedField<dim> &source,
+                     const DoFHandler<dim> &target_dof_handler,
+                     Vector<double> &target)
+    {
+        target.reinit(target_dof_handler.n_dofs());
+
+        if (have_identical_dofs(source.get_dof_handler(), target_dof_handler))
+        {
+            target = source.get_field();
+            return;
+        }
+
+        std::vector<Point<dim>> support_points(target_dof_handler.n_dofs());
+        DoFTools::map_dofs_to_support_points(StaticMappingQ1<dim>::mapping,
+                                             target_dof_handler,
+                                             support_points);
+
+        Point<dim> lower = support_points[0], upper = support_points[0];
+        for (auto &point : support_points)
+        {
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                lower[axis] = std::min(lower[axis], point[axis]);
+                upper[axis] = std::max(upper[axis], point[axis]);
+            }
+        }
+
+        std::vector<std::pair<std::uint64_t, types::global_dof_index>> ordered_dofs(support_points.size());
+        for (types::global_dof_index i = 0; i < support_points.size(); ++i)
+        {
+            ordered_dofs[i] = std::make_pair(morton_code(support_points[i], lower, upper), i);
+        }
+        std::sort(ordered_dofs.begin(), ordered_dofs.end());
+
+        /* Every DoF is written exactly once, so the sub-ranges can be processed concurrently. */
+        const unsigned int grainsize = 512;
+        parallel::apply_to_subranges(
+            0u, (unsigned int)ordered_dofs.size(),
+            [&source, &support_points, &ordered_dofs, &target]
+            (const unsigned int begin, const unsigned int end)
+            {
+                Tracing::Scope trace("interpolate_subrange");
+                typename DoFHandler<dim>::active_cell_iterator hint;
+                for (unsigned int i = begin; i < end; ++i)
+                {
+                    const types::global_dof_index dof = ordered_dofs[i].second;
+                    target(dof) = source.value(support_points[dof], hint);
+                }
+            },
+            grainsize);
+    }
+
+}
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef _instrumentation_h_
+#define _instrumentation_h_
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "tracing.h"
+
+/**
+ * @brief A registry of hierarchical timers and counters, with JSON and CSV export.
+ *
+ * @detail
+ *
+ *    Timers are named by their path in the call hierarchy, e.g. "run/time_step/solve_time_step/krylov_solve",
+ *    so that the time of every phase can be attributed to its callers.
+ *    Counters record values, e.g. solver iterations or bytes written, at the path of the enclosing timer.
+ *
+ *    Timers must only be started and stopped on the main thread, in LIFO order, which ScopedTimer guarantees.
+ *    Counters can be added from any thread. The timer stack is guarded by the same mutex as the counters,
+ *    so a counter which is added by a worker thread goes to the timer scope which the main thread is in.
+ *
+ *    CPU times are for the whole process, i.e. they include all threads.
+ *
+ *    Everything is a no-op until the registry is enabled, so instrumented code costs nothing by default.
+ *    Every ScopedTimer is also recorded as a Tracing event, if tracing is enabled.
+ *
+ *    Heap allocations are only counted if the program includes allocation_counting.h,
+ *    and only while allocation_counting_enabled() is set.
+*/
+namespace Instrumentation
+{
+    /*! Accumulated timings of one timer path */
+    struct TimerStatistics
+    {
+        TimerStatistics() : count(0), wall_seconds(0.), cpu_seconds(0.) {}
+
+        unsigned long count;
+        double wall_seconds;
+        double cpu_seconds;
+    };
+
+    /*! Accumulated values of one counter path */
+    struct CounterStatistics
+    {
+        CounterStatistics()
+            :
+            count(0), sum(0.),
+            min(std::numeric_limits<double>::max()),
+            max(-std::numeric_limits<double>::max()),
+            last(0.)
+        {}
+
+        unsigned long count;
+        double sum;
+        double min;
+        double max;
+        double last;
+    };
+
+    class Registry
+    {
+    public:
+        Registry() : enabled(false) {}
+
+        bool enabled;
+
+        /*! Enter a timer scope. Returns the path of the scope. */
+        std::string push(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stack.push_back(name);
+            return this->current_path();
+        }
+
+        /*! Leave the innermost timer scope, adding the measured times to it */
+        void pop(const double wall_seconds, const double cpu_seconds)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            TimerStatistics &timer = this->timers[this->current_path()];
+            ++timer.count;
+            timer.wall_seconds += wall_seconds;
+            timer.cpu_seconds += cpu_seconds;
+            this->stack.pop_back();
+        }
+
+        /*! Add a value to the counter with the given name, in the innermost timer scope */
+        void add(const std::string &name, const double value)
+        {
+            /* The main thread may push or pop a timer scope meanwhile. */
+            std::lock_guard<std::mutex> lock(this->mutex);
+            const std::string path = this->current_path();
+            CounterStatistics &counter = this->counters[path + (path.empty() ? "" : "/") + name];
+            ++counter.count;
+            counter.sum += value;
+            counter.min = std::min(counter.min, value);
+            counter.max = std::max(counter.max, value);
+            counter.last = value;
+        }
+
+        void write_json(const std::string &file_path) const
+        {
+            std::ofstream file(file_path);
+            if (!file.good())
+            {
+                throw std::runtime_error("Error while opening the file: " + file_path);
+            }
+            file << std::setprecision(9);
+            file << "{\n  \"timers\": {";
+            bool first = true;
+            for (auto &timer : this->timers)
+            {
+                file << (first ? "" : ",") << "\n    " << quote(timer.first) << ": {"
+                    << "\"count\": " << timer.second.count
+                    << ", \"wall_seconds\": " << timer.second.wall_seconds
+                    << ", \"cpu_seconds\": " << timer.second.cpu_seconds << "}";
+                first = false;
+            }
+            file << "\n  },\n  \"counters\": {";
+            first = true;
+            for (auto &counter : this->counters)
+            {
+                file << (first ? "" : ",") << "\n    " << quote(counter.first) << ": {"
+                    << "\"count\": " << counter.second.count
+                    << ", \"sum\": " << counter.second.sum
+                    << ", \"min\": " << counter.second.min
+                    << ", \"max\": " << counter.second.max
+                    << ", \"last\": " << counter.second.last << "}";
+                first = false;
+            }
+            file << "\n  }\n}\n";
+        }
+
+        void write_csv(const std::string &file_path) const
+        {
+            std::ofstream file(file_path);
+            if (!file.good())
+            {
+                throw std::runtime_error("Error while opening the file: " + file_path);
+            }
+            file << std::setprecision(9);
+            file << "kind,path,count,wall_seconds,cpu_seconds,sum,min,max,last\n";
+            for (auto &timer : this->timers)
+            {
+                file << "timer," << timer.first << "," << timer.second.count << ","
+                    << timer.second.wall_seconds << "," << timer.second.cpu_seconds << ",,,,\n";
+            }
+            for (auto &counter : this->counters)
+            {
+                file << "counter," << counter.first << "," << counter.second.count << ",,,"
+                    << counter.second.sum << "," << counter.second.min << ","
+                    << counter.second.max << "," << counter.second.last << "\n";
+            }
+        }
+
+        /*! Open a stream to which write_step appends one JSON object per line */
+        void open_step_stream(const std::string &file_path)
+        {
+            this->step_stream.open(file_path, std::ios::trunc);
+            if (!this->step_stream.good())
+            {
+                throw std::runtime_error("Error while opening the file: " + file_path);
+            }
+            this->step_stream << std::setprecision(9);
+        }
+
+        /*! Write the wall time of every timer and the sum of every counter since the previous step */
+        void write_step(const unsigned int step, const double time)
+        {
+            if (!this->step_stream.is_open())
+            {
+                return;
+            }
+            this->step_stream << "{\"step\": " << step << ", \"time\": " << time << ", \"wall_seconds\": {";
+            bool first = true;
+            for (auto &timer : this->timers)
+            {
+                const double delta = timer.second.wall_seconds
+                    - this->timers_at_last_step[timer.first].wall_seconds;
+                if (delta > 0.)
+                {
+                    this->step_stream << (first ? "" : ", ") << quote(timer.first) << ": " << delta;
+                    first = false;
+                }
+            }
+            this->step_stream << "}, \"counters\": {";
+            first = true;
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (auto &counter : this->counters)
+            {
+                const CounterStatistics &previous = this->counters_at_last_step[counter.first];
+                if (counter.second.count > previous.count)
+                {
+                    this->step_stream << (first ? "" : ", ") << quote(counter.first) << ": "
+                        << counter.second.sum - previous.sum;
+                    first = false;
+                }
+            }
+            this->step_stream << "}}" << std::endl;
+            this->timers_at_last_step = this->timers;
+            this->counters_at_last_step = this->counters;
+        }
+
+    private:
+        /*! The path of the innermost timer scope. The caller must hold the mutex. */
+        std::string current_path() const
+        {
+            std::string path;
+            for (auto &name : this->stack)
+            {
+                path += (path.empty() ? "" : "/") + name;
+            }
+            return path;
+        }
+
+        std::vector<std::string> stack;
+
+        std::map<std::string, TimerStatistics> timers;
+
+        std::map<std::string, CounterStatistics> counters;
+
+        std::map<std::string, TimerStatistics> timers_at_last_step;
+
+        std::map<std::string, CounterStatistics> counters_at_last_step;
+
+        std::ofstream step_stream;
+
+        std::mutex mutex;
+
+        static std::string quote(const std::string &text)
+        {
+            std::string quoted = "\"";
+            for (char c : text)
+            {
+                if ((c == '"') || (c == '\\'))
+                {
+                    quoted += '\\';
+                }
+                quoted += c;
+            }
+            return quoted + "\"";
+        }
+    };
+
+    /*! The registry for the whole program */
+    inline Registry &registry()
+    {
+        static Registry instance;
+        return instance;
+    }
+
+    /*! Time a scope, from construction until stop() or destruction, whichever comes first
+    
+        The name must be a string literal, since it is also used for tracing.
+    
+    */
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(const char *name)
+            :
+            name(name),
+            running(registry().enabled),
+            tracing(Tracing::enabled())
+        {
+            if (this->tracing)
+            {
+                Tracing::begin(name);
+            }
+            if (this->running)
+            {
+                registry().push(name);
+                this->wall_start = std::chrono::steady_clock::now();
+                this->cpu_start = std::clock();
+            }
+        }
+
+        ~ScopedTimer()
+        {
+            this->stop();
+        }
+
+        void stop()
+        {
+            if (this->tracing)
+            {
+                Tracing::end(this->name);
+                this->tracing = false;
+            }
+            if (!this->running)
+            {
+                return;
+            }
+            const double wall_seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - this->wall_start).count();
+            const double cpu_seconds = double(std::clock() - this->cpu_start)/CLOCKS_PER_SEC;
+            registry().pop(wall_seconds, cpu_seconds);
+            this->running = false;
+        }
+
+    private:
+        const char *name;
+
+        bool running;
+
+        bool tracing;
+
+        std::chrono::steady_clock::time_point wall_start;
+
+        std::clock_t cpu_start;
+    };
+
+    /*! Add a value to a counter in the innermost timer scope */
+    inline void add(const std::string &name, const double value)
+    {
+        if (registry().enabled)
+        {
+            registry().add(name, value);
+        }
+    }
+
+    /*! Add the size of a file, e.g. one which was just written, to a counter */
+    inline void add_file_size(const std::string &name, const std::string &file_path)
+    {
+        if (!registry().enabled)
+        {
+            return;
+        }
+        struct stat file_status;
+        if (stat(file_path.c_str(), &file_status) == 0)
+        {
+            registry().add(name, double(file_status.st_size));
+        }
+    }
+    
+    /*! True if heap allocations are counted, which Peclet::run sets together with Registry::enabled */
+    inline std::atomic<bool> &allocation_counting_enabled()
+    {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+    
+    /*! The number of heap allocations since allocation counting was enabled */
+    inline std::atomic<unsigned long long> &allocation_count()
+    {
+        static std::atomic<unsigned long long> count(0);
+        return count;
+    }
+    
+    /*! The total size of the heap allocations since allocation counting was enabled, in bytes */
+    inline std::atomic<unsigned long long> &allocated_bytes()
+    {
+        static std::atomic<unsigned long long> bytes(0);
+        return bytes;
+    }
+    
+    /*! The peak resident set size of the process, in bytes */
+    inline double peak_resident_bytes()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0.;
+        }
+        /* Linux reports kilobytes. */
+        return 1024.*double(usage.ru_maxrss);
+    }
+    
+    /*! The current resident set size of the process, in bytes, or zero where /proc is not available */
+    inline double current_resident_bytes()
+    {
+        std::ifstream statm("/proc/self/statm");
+        unsigned long size_pages = 0, resident_pages = 0;
+        if (!(statm >> size_pages >> resident_pages))
+        {
+            return 0.;
+        }
+        return double(resident_pages)*double(sysconf(_SC_PAGESIZE));
+    }
+    
+    /*! Add the allocation and memory statistics of the whole process to counters in the innermost timer scope */
+    inline void add_process_statistics()
+    {
+        add("allocations", double(allocation_count().load()));
+        add("allocated_bytes", double(allocated_bytes().load()));
+        add("peak_resident_bytes", peak_resident_bytes());
+    }
+
+}
+
+#endif
@@ -1,15 +1,45 @@
 #include "peclet.h"
 
+/* Count heap allocations for the instrumentation summary */
+#include "allocation_counting.h"
+
 int main(int argc, char* argv[])
 {
     try
-    {   
-        
+    {
+        /* MPI is only used for writing HDF5 output, which deal.II implements in parallel.
+        The thread limit is left at its default, so that the assembly, the grid transfer and the SpMV
+        run on every core, or on DEAL_II_NUM_THREADS threads if that is set. */
+        dealii::Utilities::MPI::MPI_InitFinalize mpi_initialization(argc, argv);
+
+        if ((argc == 4) && (std::string(argv[1]) == "--export-1D-solution-table"))
+        {
+            SolutionHistory1D::export_to_text(argv[2], argv[3]);
+
+            return 0;
+        }
+
+        /* Usage: peclet [--resume | --estimate] [parameter_input_file_path] */
         std::string parameter_input_file_path = "";
+
+        bool resume = false;
         
-        if (argc == 2)
+        bool estimate = false;
+
+        for (int i = 1; i < argc; ++i)
         {
-            parameter_input_file_path = argv[1];
+            if (std::string(argv[i]) == "--resume")
+            {
+                resume = true;
+            }
+            else if (std::string(argv[i]) == "--estimate")
+            {
+                estimate = true;
+            }
+            else
+            {
+                parameter_input_file_path = argv[i];
+            }
         }
         
         Peclet::Parameters::Meta mp = 
@@ -24,16 +54,34 @@ int main(int argc, char* argv[])
         Peclet::Peclet<2> peclet_2D;
         Peclet::Peclet<3> peclet_3D;
 
+        if (estimate)
+        {
+            switch (mp.dim)
+            {
+                case 1:
+                    peclet_1D.estimate(parameter_input_file_path);
+                    break;
+                case 2:
+                    peclet_2D.estimate(parameter_input_file_path);
+                    break;
+                case 3:
+                    peclet_3D.estimate(parameter_input_file_path);
+                    break;
+            }
+            
+            return 0;
+        }
+        
         switch (mp.dim)
         {
             case 1:
-                peclet_1D.run(parameter_input_file_path);
+                peclet_1D.run(parameter_input_file_path, resume);
                 break;
             case 2:
-                peclet_2D.run(parameter_input_file_path);
+                peclet_2D.run(parameter_input_file_path, resume);
                 break;
             case 3:
-                peclet_3D.run(parameter_input_file_path);
+                peclet_3D.run(parameter_input_file_path, resume);
                 break;
         }
 
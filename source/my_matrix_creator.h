@@ -23,6 +23,14 @@
 #include <deal.II/lac/block_sparse_matrix.h>
 
 #include <deal.II/numerics/matrix_creator.templates.h>
+#include <deal.II/grid/cell_id.h>
+
+#include <map>
+#include <vector>
+
+#include "cell_chunks.h"
+#include "instrumentation.h"
+#include "streamline_diffusion.h"
 
 
 namespace MyMatrixCreator
@@ -40,7 +48,8 @@ namespace MyMatrixCreator
                  const Function<dim,number> *diffusivity,
                  const Function<dim,number> *convection_velocity,
                  const ::dealii::hp::QCollection<dim> &quadrature,
-                 const ::dealii::hp::MappingCollection<dim> &mapping)
+                 const ::dealii::hp::MappingCollection<dim> &mapping,
+                 const bool streamline_diffusion = false)
           :
           fe_collection (fe),
           quadrature_collection (quadrature),
@@ -54,7 +63,8 @@ namespace MyMatrixCreator
                                      Vector<number> (dim)),
           diffusivity (diffusivity),
           convection_velocity (convection_velocity),
-          update_flags (update_flags)
+          update_flags (update_flags),
+          streamline_diffusion (streamline_diffusion)
         {}
 
         Scratch (const Scratch &data)
@@ -71,7 +81,8 @@ namespace MyMatrixCreator
           diffusivity (data.diffusivity),
           convection_velocity (data.convection_velocity),
           rhs_function (data.rhs_function),
-          update_flags (data.update_flags)
+          update_flags (data.update_flags),
+          streamline_diffusion (data.streamline_diffusion)
         {}
 
         const ::dealii::hp::FECollection<dim>      &fe_collection;
@@ -90,6 +101,9 @@ namespace MyMatrixCreator
         const Function<dim,number>   *rhs_function;
 
         const UpdateFlags update_flags;
+        
+        /*! Add the SUPG terms, see StreamlineDiffusion. This requires update_hessians. */
+        const bool streamline_diffusion;
       };
 
     }
@@ -206,6 +220,8 @@ namespace MyMatrixCreator
     {
         Assert (matrix.m() == dof.n_dofs(), ExcDimensionMismatch (matrix.m(), dof.n_dofs()));
         Assert (matrix.n() == dof.n_dofs(), ExcDimensionMismatch (matrix.n(), dof.n_dofs()));
+        
+        Instrumentation::ScopedTimer timer("create_convection_diffusion_matrix");
 
         hp::FECollection<dim>      fe_collection (dof.get_fe());
         hp::QCollection<dim>                q_collection (q);
@@ -228,17 +244,19 @@ namespace MyMatrixCreator
 
         copy_data.constraints = &constraints;
         
-        WorkStream::run(
+        CellChunks::run(
             dof.begin_active(),
             static_cast<typename DoFHandler<dim>::active_cell_iterator>(dof.end()),
             &convection_diffusion_assembler<dim, typename DoFHandler<dim>::active_cell_iterator>,
-            std_cxx11::bind (&MatrixCreator::internal::
-                          copy_local_to_global<double,SparseMatrix<double>, Vector<double> >,
-                          std_cxx11::_1,
-                          &matrix,
-                          (Vector<double> *)NULL),
+            [&matrix](const MatrixCreator::internal::AssemblerData::CopyData<double> &data)
+            {
+                MatrixCreator::internal::copy_local_to_global<double,SparseMatrix<double>, Vector<double> > (
+                    data, &matrix, (Vector<double> *)NULL);
+            },
             assembler_data,
-            copy_data);
+            copy_data,
+            "assemble_cells",
+            "copy_local_to_global");
     }
 
 
@@ -255,6 +273,232 @@ namespace MyMatrixCreator
             dof, q, matrix, diffusivity, convection_velocity, constraints);
     }
     
+    /*! The local mass and convection-diffusion matrices of one cell
+    
+        These only depend on the cell geometry and the time-independent coefficients,
+        so they remain valid for as long as the cell is active.
+        
+    */
+    struct CellMatrices
+    {
+        FullMatrix<double> mass;
+        FullMatrix<double> convection_diffusion;
+    };
+    
+    /*! Local cell matrices keyed by the ID of their cell, which is stable under refinement of other cells */
+    typedef std::map<CellId, CellMatrices> CellMatrixCache;
+    
+    namespace AssemblerData
+    {
+      struct CellMatricesCopyData
+      {
+        CellId cell_id;
+        CellMatrices matrices;
+      };
+    }
+    
+    template <int dim,
+              typename CellIteratorIterator>
+    void mass_and_convection_diffusion_assembler (
+        const CellIteratorIterator &cell_iterator,
+        AssemblerData::Scratch<dim,double> &data,
+        AssemblerData::CellMatricesCopyData &copy_data)
+    {
+        MatrixCreator::internal::AssemblerData::CopyData<double> convection_diffusion_copy_data;
+        
+        convection_diffusion_assembler<dim> (*cell_iterator, data, convection_diffusion_copy_data);
+        
+        const FEValues<dim> &fe_values = data.x_fe_values.get_present_fe_values ();
+        
+        const unsigned int dofs_per_cell = fe_values.dofs_per_cell,
+                         n_q_points    = fe_values.n_quadrature_points;
+                         
+        const std::vector<double> &JxW = fe_values.get_JxW_values();
+        
+        copy_data.cell_id = (*cell_iterator)->id();
+        
+        copy_data.matrices.convection_diffusion = convection_diffusion_copy_data.cell_matrix;
+        
+        copy_data.matrices.mass.reinit (dofs_per_cell, dofs_per_cell);
+        
+        for (unsigned int i=0; i<dofs_per_cell; ++i)
+        {
+            const double *phi_i = &fe_values.shape_value(i,0);
+            
+            for (unsigned int j=0; j<dofs_per_cell; ++j)
+            {
+                const double *phi_j = &fe_values.shape_value(j,0);
+                
+                double add_data = 0;
+                
+                for (unsigned int point=0; point<n_q_points; ++point)
+                {
+                    add_data += phi_i[point] * phi_j[point] * JxW[point];
+                }
+                
+                copy_data.matrices.mass(i,j) = add_data;
+            }
+        }
+        
+        if (!data.streamline_diffusion)
+        {
+            return;
+        }
+        
+        /* Test with tau v . grad phi_i, which is consistent for the mass, convection and diffusion terms. */
+        const double tau = StreamlineDiffusion::cell_parameter(
+            (*cell_iterator)->diameter(), fe_values.get_fe().degree,
+            data.convection_velocity_values, data.diffusivity_values, n_q_points);
+            
+        if (tau == 0.)
+        {
+            return;
+        }
+        
+        std::vector<double> streamline_derivatives_i (n_q_points), streamline_derivatives_j (n_q_points);
+        
+        for (unsigned int i=0; i<dofs_per_cell; ++i)
+        {
+            for (unsigned int point=0; point<n_q_points; ++point)
+            {
+                streamline_derivatives_i[point] = 0.;
+                
+                for (unsigned int ia = 0; ia < dim; ia++)
+                {
+                    streamline_derivatives_i[point] += data.convection_velocity_values[point][ia]*
+                        fe_values.shape_grad(i,point)[ia];
+                }
+            }
+            
+            for (unsigned int j=0; j<dofs_per_cell; ++j)
+            {
+                double mass_data = 0, convection_diffusion_data = 0;
+                
+                for (unsigned int point=0; point<n_q_points; ++point)
+                {
+                    streamline_derivatives_j[point] = 0.;
+                    
+                    for (unsigned int ia = 0; ia < dim; ia++)
+                    {
+                        streamline_derivatives_j[point] += data.convection_velocity_values[point][ia]*
+                            fe_values.shape_grad(j,point)[ia];
+                    }
+                    
+                    const double laplacian_phi_j = trace(fe_values.shape_hessian(j,point));
+                    
+                    mass_data += streamline_derivatives_i[point] * fe_values.shape_value(j,point) * JxW[point];
+                    
+                    convection_diffusion_data += streamline_derivatives_i[point] *
+                        (streamline_derivatives_j[point] - data.diffusivity_values[point]*laplacian_phi_j) *
+                        JxW[point];
+                }
+                
+                copy_data.matrices.mass(i,j) += tau*mass_data;
+                
+                copy_data.matrices.convection_diffusion(i,j) += tau*convection_diffusion_data;
+            }
+        }
+    }
+    
+    /*
+
+    @brief Create the mass and convection-diffusion matrices, only assembling cells which are not cached
+
+    @detail
+
+        After adaptive refinement most active cells are unchanged, and their local matrices
+        are taken from the cache. Only new cells are assembled, in parallel via WorkStream.
+        The cache is updated to contain exactly the present active cells.
+        
+        The matrices must have been initialized with a sparsity pattern for dof.
+        
+        If streamline_diffusion is true, then the SUPG terms are included in both matrices,
+        so the cache must only be reused with the same setting.
+        
+    */
+    template <int dim>
+    void create_mass_and_convection_diffusion_matrices (
+        const DoFHandler<dim> &dof,
+        const Quadrature<dim> &q,
+        SparseMatrix<double> &mass_matrix,
+        SparseMatrix<double> &convection_diffusion_matrix,
+        const Function<dim> *const diffusivity,
+        const Function<dim> *const convection_velocity,
+        CellMatrixCache &cache,
+        const bool streamline_diffusion = false)
+    {
+        Instrumentation::ScopedTimer timer("create_mass_and_convection_diffusion_matrices");
+        
+        typedef typename DoFHandler<dim>::active_cell_iterator ActiveCellIterator;
+        
+        CellMatrixCache updated_cache;
+        
+        std::vector<ActiveCellIterator> new_cells;
+        
+        for (auto cell : dof.active_cell_iterators())
+        {
+            auto cached = cache.find(cell->id());
+            
+            if (cached != cache.end())
+            {
+                updated_cache[cell->id()] = std::move(cached->second);
+            }
+            else
+            {
+                new_cells.push_back(cell);
+            }
+        }
+        
+        Instrumentation::add("assembled_cells", new_cells.size());
+        
+        hp::FECollection<dim>      fe_collection (dof.get_fe());
+        hp::QCollection<dim>                q_collection (q);
+        hp::MappingCollection<dim> mapping_collection (StaticMappingQ1<dim>::mapping);
+        
+        AssemblerData::Scratch<dim,double> assembler_data (
+                            fe_collection,
+                            update_values | update_gradients  |
+                                update_JxW_values | update_quadrature_points |
+                                (streamline_diffusion ? update_hessians : update_default),
+                            diffusivity,
+                            convection_velocity,
+                            q_collection, mapping_collection,
+                            streamline_diffusion);
+                            
+        AssemblerData::CellMatricesCopyData copy_data;
+        
+        typedef typename std::vector<ActiveCellIterator>::const_iterator CellIteratorIterator;
+        
+        /* Only the sequential copier touches the cache. */
+        CellChunks::run(
+            new_cells.cbegin(),
+            new_cells.cend(),
+            &mass_and_convection_diffusion_assembler<dim, CellIteratorIterator>,
+            [&updated_cache](const AssemblerData::CellMatricesCopyData &copy_data)
+            {
+                updated_cache[copy_data.cell_id] = copy_data.matrices;
+            },
+            assembler_data,
+            copy_data,
+            "assemble_cells",
+            "copy_cell_matrices");
+            
+        cache.swap(updated_cache);
+        
+        std::vector<types::global_dof_index> dof_indices (dof.get_fe().dofs_per_cell);
+        
+        for (auto cell : dof.active_cell_iterators())
+        {
+            const CellMatrices &matrices = cache.at(cell->id());
+            
+            cell->get_dof_indices (dof_indices);
+            
+            mass_matrix.add (dof_indices, matrices.mass);
+            
+            convection_diffusion_matrix.add (dof_indices, matrices.convection_diffusion);
+        }
+    }
+    
 }
 
 #endif
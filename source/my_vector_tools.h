@@ -3,6 +3,11 @@
 
 #include <deal.II/numerics/vector_tools.h>
 
+#include <map>
+
+#include "instrumentation.h"
+#include "streamline_diffusion.h"
+
 namespace MyVectorTools
 {
     
@@ -23,6 +28,7 @@ namespace MyVectorTools
                                    Vector<double>          &rhs_vector,
                                    const std::set<types::boundary_id> &boundary_ids)
   {
+    Instrumentation::ScopedTimer timer("create_boundary_right_hand_side");
     
     const FiniteElement<dim> &fe  = dof_handler.get_fe();
     Assert (fe.n_components() == rhs_function.n_components,
@@ -149,6 +155,142 @@ namespace MyVectorTools
                                     rhs_function, rhs_vector,
                                     boundary_ids);
   }
+  
+  /*
+  Add the forcing of one step of the theta-scheme to rhs_vector in a single sweep over the cells, i.e.
+  the integral of Delta_t*(theta*s(t) + (1 - theta)*s(t - Delta_t)) phi_i, with its SUPG term if
+  convection_velocity is given, and the same combination of the fluxes of the given boundaries.
+  The SUPG term of the source is the integral of tau s v . grad phi_i, with tau computed per cell exactly as
+  for the SUPG matrices, see StreamlineDiffusion.
+  This replaces a create_right_hand_side and a my_create_boundary_right_hand_side per time level and boundary,
+  and the vector copies which combined them.
+  Every function is evaluated at both times on each cell, and is left at time t.
+  */
+  template <int dim>
+  void
+  add_theta_forcing_right_hand_side (const DoFHandler<dim>   &dof_handler,
+                                  const Quadrature<dim>   &quadrature,
+                                  const Quadrature<dim-1> &face_quadrature,
+                                  Function<dim>           &rhs_function,
+                                  const std::map<types::boundary_id, Function<dim>*> &boundary_functions,
+                                  const Function<dim>     *convection_velocity,
+                                  const Function<dim>     &diffusivity,
+                                  const double             time,
+                                  const double             time_step_size,
+                                  const double             theta,
+                                  Vector<double>          &rhs_vector)
+  {
+    Assert (rhs_vector.size() == dof_handler.n_dofs(),
+            ExcDimensionMismatch(rhs_vector.size(), dof_handler.n_dofs()));
+
+    Instrumentation::ScopedTimer timer("add_theta_forcing_right_hand_side");
+
+    const bool supg = (convection_velocity != nullptr);
+
+    const double new_weight = time_step_size*theta,
+                 old_weight = time_step_size*(1. - theta);
+
+    FEValues<dim> fe_values (StaticMappingQ1<dim>::mapping, dof_handler.get_fe(), quadrature,
+                             update_values | update_quadrature_points | update_JxW_values
+                             | (supg ? update_gradients : update_default));
+
+    FEFaceValues<dim> fe_face_values (StaticMappingQ1<dim>::mapping, dof_handler.get_fe(), face_quadrature,
+                                      update_values | update_quadrature_points | update_JxW_values);
+
+    const unsigned int dofs_per_cell   = fe_values.dofs_per_cell,
+                       n_q_points      = fe_values.n_quadrature_points,
+                       n_face_q_points = fe_face_values.n_quadrature_points;
+
+    std::vector<types::global_dof_index> dofs (dofs_per_cell);
+    Vector<double> cell_vector (dofs_per_cell);
+    std::vector<double> rhs_values (n_q_points), old_rhs_values (n_q_points), diffusivity_values (n_q_points);
+    std::vector<Vector<double> > velocity_values (n_q_points, Vector<double>(dim));
+    std::vector<double> flux_values (n_face_q_points), old_flux_values (n_face_q_points);
+
+    /* The theta-weighted combination of both time levels of a function at the points */
+    auto theta_values = [&](Function<dim> &function, const std::vector<Point<dim> > &points,
+                            std::vector<double> &values, std::vector<double> &old_values)
+      {
+        function.set_time (time);
+        function.value_list (points, values);
+
+        for (unsigned int point=0; point<values.size(); ++point)
+          values[point] *= new_weight;
+
+        if (old_weight == 0.)
+          return;
+
+        function.set_time (time - time_step_size);
+        function.value_list (points, old_values);
+
+        for (unsigned int point=0; point<values.size(); ++point)
+          values[point] += old_weight*old_values[point];
+      };
+
+    for (auto cell : dof_handler.active_cell_iterators())
+      {
+        fe_values.reinit (cell);
+
+        theta_values (rhs_function, fe_values.get_quadrature_points(), rhs_values, old_rhs_values);
+
+        double tau = 0.;
+
+        if (supg)
+          {
+            diffusivity.value_list (fe_values.get_quadrature_points(), diffusivity_values);
+            convection_velocity->vector_value_list (fe_values.get_quadrature_points(), velocity_values);
+
+            tau = StreamlineDiffusion::cell_parameter(
+                cell->diameter(), dof_handler.get_fe().degree, velocity_values, diffusivity_values, n_q_points);
+          }
+
+        cell_vector = 0;
+        for (unsigned int point=0; point<n_q_points; ++point)
+          for (unsigned int i=0; i<dofs_per_cell; ++i)
+            {
+              double test_value = fe_values.shape_value(i,point);
+
+              if (tau != 0.)
+                for (unsigned int d=0; d<dim; ++d)
+                  test_value += tau * velocity_values[point][d] * fe_values.shape_grad(i,point)[d];
+
+              cell_vector(i) += rhs_values[point] * test_value * fe_values.JxW(point);
+            }
+
+        if (!boundary_functions.empty() && cell->at_boundary())
+          for (unsigned int face=0; face<GeometryInfo<dim>::faces_per_cell; ++face)
+            {
+              if (!cell->face(face)->at_boundary())
+                continue;
+
+              const auto boundary_function = boundary_functions.find (cell->face(face)->boundary_id());
+
+              if (boundary_function == boundary_functions.end())
+                continue;
+
+              fe_face_values.reinit (cell, face);
+
+              theta_values (*boundary_function->second, fe_face_values.get_quadrature_points(),
+                            flux_values, old_flux_values);
+
+              for (unsigned int point=0; point<n_face_q_points; ++point)
+                for (unsigned int i=0; i<dofs_per_cell; ++i)
+                  cell_vector(i) += flux_values[point] *
+                                    fe_face_values.shape_value(i,point) *
+                                    fe_face_values.JxW(point);
+            }
+
+        cell->get_dof_indices (dofs);
+
+        for (unsigned int i=0; i<dofs_per_cell; ++i)
+          rhs_vector(dofs[i]) += cell_vector(i);
+      }
+
+    rhs_function.set_time (time);
+
+    for (auto &boundary_function : boundary_functions)
+      boundary_function.second->set_time (time);
+  }
 
 }
 
@@ -1,3 +1,5 @@
+#include <deal.II/base/data_out_base.h>
+#include <deal.II/base/mpi.h>
 #include <deal.II/dofs/dof_handler.h>
 #include <deal.II/lac/vector.h>
 #include <deal.II/grid/grid_out.h>
@@ -5,11 +7,13 @@
 
 #include <iostream>
 #include <fstream>
+#include <utility>
+#include <vector>
 
 namespace Output
 {
     using namespace dealii;
-    
+
     template<int dim>
     void write_solution_to_vtk(
         const std::string filename,
@@ -23,6 +27,102 @@ namespace Output
         data_out.build_patches();
         std::ofstream output(filename.c_str());
         data_out.write_vtk(output);
-    }    
-    
+    }
+
+    /*! Write the solution to a zlib compressed binary VTU file.
+
+        The time and cycle are embedded in the file, so that ParaView and VisIt can show them
+        even without the PVD record.
+
+    */
+    template<int dim>
+    void write_solution_to_vtu(
+        const std::string filename,
+        DoFHandler<dim> &dof_handler,
+        Vector<double> &solution,
+        const double time,
+        const unsigned int cycle
+        )
+    {
+        DataOut<dim> data_out;
+        data_out.attach_dof_handler(dof_handler);
+        data_out.add_data_vector(solution, "U");
+        data_out.build_patches();
+        DataOutBase::VtkFlags flags;
+        flags.time = time;
+        flags.cycle = cycle;
+        flags.compression_level = DataOutBase::VtkFlags::best_speed;
+        data_out.set_flags(flags);
+        std::ofstream output(filename.c_str(), std::ios::binary);
+        if (!output.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + filename);
+        }
+        data_out.write_vtu(output);
+    }
+
+    /*! Write a PVD record listing every VTU file written so far.
+
+        This is re-written after every output step, so that the record is valid even if the run is interrupted.
+
+    */
+    inline void write_pvd_record(
+        const std::string filename,
+        const std::vector<std::pair<double, std::string>> &times_and_names)
+    {
+        std::ofstream output(filename.c_str());
+        if (!output.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + filename);
+        }
+        output << "<?xml version=\"1.0\"?>" << std::endl
+               << "<VTKFile type=\"Collection\" version=\"0.1\" ByteOrder=\"LittleEndian\">" << std::endl
+               << "  <Collection>" << std::endl;
+        output.precision(16);
+        for (auto &time_and_name : times_and_names)
+        {
+            output << "    <DataSet timestep=\"" << time_and_name.first
+                   << "\" group=\"\" part=\"0\" file=\"" << time_and_name.second
+                   << "\"/>" << std::endl;
+        }
+        output << "  </Collection>" << std::endl
+               << "</VTKFile>" << std::endl;
+    }
+
+#ifdef DEAL_II_WITH_HDF5
+    /*! Write the solution to HDF5 and append a step to the XDMF time series.
+
+        The mesh is only written when write_mesh_file is true, i.e. once per topology change.
+        Every other step only writes the scalar field and references the existing mesh file.
+        The XDMF file is re-written after every output step.
+
+    */
+    template<int dim>
+    void write_solution_to_hdf5(
+        const std::string mesh_filename,
+        const bool write_mesh_file,
+        const std::string solution_filename,
+        const std::string xdmf_filename,
+        const double time,
+        DoFHandler<dim> &dof_handler,
+        Vector<double> &solution,
+        std::vector<XDMFEntry> &xdmf_entries
+        )
+    {
+        DataOut<dim> data_out;
+        data_out.attach_dof_handler(dof_handler);
+        data_out.add_data_vector(solution, "U");
+        data_out.build_patches();
+        DataOutBase::DataOutFilter data_filter(
+            DataOutBase::DataOutFilterFlags(/* filter_duplicate_vertices = */ true,
+                                            /* xdmf_hdf5_output = */ true));
+        data_out.write_filtered_data(data_filter);
+        data_out.write_hdf5_parallel(data_filter, write_mesh_file,
+            mesh_filename, solution_filename, MPI_COMM_WORLD);
+        xdmf_entries.push_back(data_out.create_xdmf_entry(data_filter,
+            mesh_filename, solution_filename, time, MPI_COMM_WORLD));
+        data_out.write_xdmf_file(xdmf_entries, xdmf_filename, MPI_COMM_WORLD);
+    }
+#endif
+
 }
@@ -5,7 +5,9 @@
 #include <deal.II/base/quadrature_lib.h>
 #include <deal.II/base/function.h>
 #include <deal.II/base/logstream.h>
+#include <deal.II/base/memory_consumption.h>
 #include <deal.II/lac/vector.h>
+#include <deal.II/lac/vector_memory.h>
 #include <deal.II/lac/full_matrix.h>
 #include <deal.II/lac/dynamic_sparsity_pattern.h>
 #include <deal.II/lac/sparse_matrix.h>
@@ -21,6 +23,7 @@
 #include <deal.II/dofs/dof_handler.h>
 #include <deal.II/dofs/dof_accessor.h>
 #include <deal.II/dofs/dof_tools.h>
+#include <deal.II/dofs/dof_renumbering.h>
 #include <deal.II/fe/fe_q.h>
 #include <deal.II/fe/fe_values.h>
 #include <deal.II/numerics/vector_tools.h>
@@ -30,19 +33,38 @@
 #include <deal.II/base/table_handler.h>
 
 #include <iostream>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <cstdlib>
 #include <functional>
+#include <limits>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <sstream>
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
 
 #include <assert.h> 
 #include <deal.II/grid/manifold_lib.h>
 #include <deal.II/grid/tria_boundary_lib.h>
 #include <deal.II/base/parsed_function.h>
 
+#include "dof_renumbering.h"
 #include "extrapolated_field.h"
+#include "grid_transfer.h"
+#include "instrumentation.h"
+#include "sell_c_sigma_matrix.h"
 #include "my_grid_generator.h"
 #include "fe_field_tools.h"
 #include "output.h"
 #include "my_matrix_creator.h"
 #include "my_vector_tools.h"
+#include "residual_error_estimator.h"
+#include "solution_history_1D.h"
 
 #include "peclet_parameters.h"
 
@@ -138,9 +160,19 @@ namespace Peclet
         /*! Run the simulation.
   
         This is the main method of the class.
+        
+        If resume is true, then the time loop continues from the checkpoint at checkpoint.file_path,
+        instead of starting from the initial values.
       
         */
-        void run(const std::string parameter_file = "");
+        void run(const std::string parameter_file = "", const bool resume = false);
+        
+        /*! Predict the size, memory, output volume and time of a run, without assembling or solving.
+        
+        This is the dry run of peclet --estimate.
+        
+        */
+        void estimate(const std::string parameter_file = "");
 
     private:
     
@@ -191,12 +223,42 @@ namespace Peclet
         */
         SparseMatrix<double> convection_diffusion_matrix;
         
+        /*! The local cell matrices of M and (C + K)
+        
+        With adaptive refinement most cells are unchanged between grids, so their local matrices are kept here
+        and only new cells are assembled when rebuilding M and (C + K).
+        
+        */
+        MyMatrixCreator::CellMatrixCache cell_matrix_cache;
+        
+        /*! Write the Chrome trace-event timeline here, unless empty. See Tracing. */
+        std::string trace_file_path;
+        
         /*! The system matrix
         
         This is the composite matrix for the entire linear system.
             
         */
         SparseMatrix<double> system_matrix;
+        
+        /*! The explicit-side operator
+        
+        This is M - (1 - theta) Delta_t (C + K), so that the old solution's contribution to the RHS is one product.
+        It is rebuilt when the mesh or the time step size changes.
+        
+        */
+        SparseMatrix<double> explicit_matrix;
+        
+        /*! True if the explicit-side operator must be rebuilt, which is set by Peclet::setup_system() */
+        bool explicit_matrix_outdated = true;
+        
+        /*! The time step size of the explicit-side operator */
+        double explicit_matrix_time_step_size = 0.;
+        
+        /*! SELL-C-sigma copies of the explicit-side operator and the system matrix, if solver.matrix_format = sell_c_sigma */
+        SellCSigma::Matrix sell_explicit_matrix;
+        
+        SellCSigma::Matrix sell_system_matrix;
 
         /*! The solution vector */
         Vector<double>       solution;
@@ -220,6 +282,9 @@ namespace Peclet
         /*! A counter to track the current time step index */
         unsigned int         time_step_counter;
         
+        /*! A counter to track the adaptive pre-refinement cycles, which restart the time loop */
+        unsigned int         pre_refinement_step;
+        
         /*! Geometric information required for exact spherical geometry */
         Point<dim> spherical_manifold_center;
         
@@ -263,22 +328,50 @@ namespace Peclet
         */
         std::string verification_table_file_name = "verification_table.txt";
         
-        /*! A deal.II TableHandler for tabulating 1D solution data
+        /*! A binary file stream to which the 1D solution is appended at every output step
     
-        This has primarily been used as a convenient output for importing the 1D data into MATLAB.
+        Every step is flushed immediately, so memory use is constant over the run. See SolutionHistory1D for the file format.
         
         This is impractical for large problems, which should use the standard visualization formats for tools such as ParaView or VisIt.
     
         */        
-        TableHandler solution_table_1D;
+        std::ofstream solution_history_1D;
         
-        /*! The path where to write the table containing 1D solution data 
+        /*! The path of the binary 1D solution history
         
-        Also see Peclet::solution_table_1D.
+        Also see Peclet::solution_history_1D.
+        
+        */
+        std::string solution_history_1D_file_name = "1D_solution_history.bin";
+        
+        /*! The path where to export the table containing 1D solution data 
+        
+        This has primarily been used as a convenient output for importing the 1D data into MATLAB.
         
         */
         std::string solution_table_1D_file_name = "1D_solution_table.txt";
         
+        /*! Times and file names of the VTU files written so far, which are listed by the PVD record */
+        std::vector<std::pair<double, std::string>> vtu_times_and_names;
+        
+#ifdef DEAL_II_WITH_HDF5
+        /*! Entries of the XDMF time series written so far */
+        std::vector<XDMFEntry> xdmf_entries;
+#endif
+        
+        /*! True if the mesh has changed since it was last written to HDF5
+        
+        This is set by Peclet::setup_system(), which is called after every topology change.
+        
+        */
+        bool mesh_changed_since_output = true;
+        
+        /*! A counter to name the HDF5 mesh files, which are only written once per topology change */
+        unsigned int mesh_output_counter = 0;
+        
+        /*! The HDF5 mesh file to which solution files written since the last topology change refer */
+        std::string mesh_file_name;
+        
         
         // Methods
         
@@ -303,9 +396,16 @@ namespace Peclet
         /*! Adaptively refine the triangulation based on an error measure.
             
         This is mostly a copy of the routine from deal.II's step-26, which uses the Kelly Error Estimator.
+        
+        Only the solution is transferred to the new grid, since run() sets the old solution to the solution
+        after refining. The residual estimator of a following refinement cycle needs the old solution though,
+        so it is also transferred if transfer_old_solution is true.
                 
         */
-        void adaptive_refine();
+        void adaptive_refine(const bool transfer_old_solution = false);
+        
+        /*! Run the initial global, boundary and a priori refinement cycles on the coarse grid. */
+        void refine_initial_grid();
         
         /*! Re-initialize the linear system data and assemble the important matrices.
         
@@ -317,11 +417,24 @@ namespace Peclet
         The separation between this method and some of the work done in Peclet::run() may not be very well organized. There may be a better approach. That being said, little has been changed here relative to the step-26 tutorial.
             
         */
-        void setup_system(bool quiet = false);
+        void setup_system(bool quiet = false, bool assemble = true);
+        
+        /*! The path of the setup cache file for the present parameters */
+        std::string setup_cache_file_path() const;
+        
+        /*! Write the refined grid, sparsity pattern and assembled operators to the setup cache. */
+        void write_setup_cache();
+        
+        /*! Read the refined grid, sparsity pattern and assembled operators from the setup cache.
+        
+        This replaces the initial grid refinement and Peclet::setup_system(). Returns false if there is no cache file for the present parameters.
+        
+        */
+        bool read_setup_cache();
         
         /*! Write the solution to files for visualization.
   
-        Only the VTK format is supported by this class; but deal.II makes it easy to use many other standard formats.
+        The legacy VTK, compressed VTU (with a PVD record), and HDF5 (with an XDMF time series) formats are supported. See the output.format parameter.
         
         Additionally for 1D problems, a simple table can be written for easy import into MATLAB.
       
@@ -338,10 +451,27 @@ namespace Peclet
         /*! Write convergence/verification data to disk. */
         void write_verification_table();
         
-        /*! Append 1D solution data to the table in memory. */
+        /*! Write the timers and counters to the instrumentation summary file, if instrumentation is enabled,
+        and the trace file, if tracing is enabled. */
+        void write_instrumentation_summary();
+        
+        /*! Print the memory used by each data structure, if the memory report is enabled. */
+        void write_memory_report(const std::string label);
+        
+        /*! Append 1D solution data to the binary history file. */
         void append_1D_solution_to_table();
         
-        /*! Write 1D solution data to disk. */
+        /*! Write the full state of the time loop to the checkpoint file. */
+        void write_checkpoint();
+        
+        /*! Restore the full state of the time loop from the checkpoint file.
+        
+        This replaces the initial grid refinement and Peclet::setup_system().
+        
+        */
+        void read_checkpoint();
+        
+        /*! Export the 1D solution history to a text table. */
         void write_1D_solution_table(std::string file_name);
     };
   
@@ -355,9 +485,67 @@ namespace Peclet
     #include "peclet_grid.h"
   
     template<int dim>
-    void Peclet<dim>::setup_system(bool quiet)
+    void Peclet<dim>::refine_initial_grid()
     {
+        this->triangulation.refine_global(this->params.refinement.initial_global_cycles);
+        
+        if (this->params.refinement.boundary_refinement == "graded")
+        {
+            Refinement::refine_mesh_near_boundaries_graded(
+                this->triangulation,
+                this->params.refinement.boundaries_to_refine,
+                this->params.refinement.initial_boundary_cycles,
+                this->params.refinement.boundary_layer_thickness,
+                *this->velocity_function,
+                *this->diffusivity_function,
+                this->params.refinement.adaptive.max_level);
+        }
+        else
+        {
+            Refinement::refine_mesh_near_boundaries(
+                this->triangulation,
+                this->params.refinement.boundaries_to_refine,
+                this->params.refinement.initial_boundary_cycles);
+        }
+        
+        Refinement::refine_mesh_a_priori(
+            this->triangulation,
+            *this->velocity_function,
+            *this->diffusivity_function,
+            this->initial_values_function,
+            this->params.refinement.a_priori.cycles,
+            this->params.refinement.a_priori.max_mesh_peclet,
+            this->params.refinement.a_priori.max_initial_gradient,
+            this->params.refinement.adaptive.max_level);
+    }
+    
+    template<int dim>
+    void Peclet<dim>::setup_system(bool quiet, bool assemble)
+    {
+        Instrumentation::ScopedTimer timer("setup_system");
+        
         dof_handler.distribute_dofs(fe);
+        
+        if (this->params.solver.dof_renumbering == "downwind")
+        {
+            MyDoFRenumbering::downwind(this->dof_handler, *this->velocity_function);
+        }
+        else if (this->params.solver.dof_renumbering == "cuthill_mckee")
+        {
+            DoFRenumbering::Cuthill_McKee(this->dof_handler);
+        }
+        else if (this->params.solver.dof_renumbering == "hilbert")
+        {
+            MyDoFRenumbering::hilbert(this->dof_handler);
+        }
+        
+        this->mesh_changed_since_output = true;
+        
+        this->explicit_matrix_outdated = true;
+        
+        Instrumentation::add("n_dofs", dof_handler.n_dofs());
+        
+        Instrumentation::add("n_active_cells", triangulation.n_active_cells());
 
         if (!quiet)
         {
@@ -379,6 +567,19 @@ namespace Peclet
             
         constraints.close();
 
+        this->solution.reinit(dof_handler.n_dofs());
+        
+        this->old_solution.reinit(dof_handler.n_dofs());
+        
+        this->system_rhs.reinit(dof_handler.n_dofs());
+        
+        if (!assemble)
+        { /* The caller is responsible for the sparsity pattern and matrices, e.g. from the setup cache. */
+            return;
+        }
+
+        Instrumentation::ScopedTimer sparsity_timer("sparsity_pattern");
+        
         DynamicSparsityPattern dsp(dof_handler.n_dofs());
         
         DoFTools::make_sparsity_pattern(
@@ -394,30 +595,62 @@ namespace Peclet
         this->convection_diffusion_matrix.reinit(this->sparsity_pattern);
         
         this->system_matrix.reinit(this->sparsity_pattern);
-
-        MatrixCreator::create_mass_matrix(
-            this->dof_handler,
-            QGauss<dim>(fe.degree+1),
-            this->mass_matrix);
-                              
-        MyMatrixCreator::create_convection_diffusion_matrix<dim>(
-            this->dof_handler,
-            QGauss<dim>(fe.degree+1),
-            this->convection_diffusion_matrix,
-            this->diffusivity_function, 
-            this->velocity_function);
-
-        this->solution.reinit(dof_handler.n_dofs());
         
-        this->old_solution.reinit(dof_handler.n_dofs());
+        sparsity_timer.stop();
         
-        this->system_rhs.reinit(dof_handler.n_dofs());
+        Instrumentation::ScopedTimer assembly_timer("assemble_matrices");
+        
+        const bool adaptive = (params.refinement.adaptive.initial_cycles > 0)
+            || (params.refinement.adaptive.interval > 0);
+        
+        const bool supg = (params.stabilization.method == "supg");
+        
+        /* The cached cell matrices only pay off when the grid is repeatedly refined. */
+        const bool cache_cell_matrices = adaptive && params.refinement.adaptive.cache_cell_matrices;
+        
+        if (cache_cell_matrices || supg)
+        { /* Only this kernel has the SUPG terms. */
+            MyMatrixCreator::create_mass_and_convection_diffusion_matrices<dim>(
+                this->dof_handler,
+                QGauss<dim>(fe.degree+1),
+                this->mass_matrix,
+                this->convection_diffusion_matrix,
+                this->diffusivity_function,
+                this->velocity_function,
+                this->cell_matrix_cache,
+                supg);
+            
+            if (!cache_cell_matrices)
+            {
+                this->cell_matrix_cache.clear();
+            }
+        }
+        else
+        {
+            MatrixCreator::create_mass_matrix(
+                this->dof_handler,
+                QGauss<dim>(fe.degree+1),
+                this->mass_matrix);
+                                  
+            MyMatrixCreator::create_convection_diffusion_matrix<dim>(
+                this->dof_handler,
+                QGauss<dim>(fe.degree+1),
+                this->convection_diffusion_matrix,
+                this->diffusivity_function, 
+                this->velocity_function);
+        }
+        
+        assembly_timer.stop();
+        
+        this->write_memory_report("setup_system");
         
     }
 
     template<int dim>
     SolverStatus Peclet<dim>::solve_time_step(bool quiet)
     {
+        Instrumentation::ScopedTimer timer("solve_time_step");
+        
         double tolerance = this->params.solver.tolerance;
         
         if (this->params.solver.normalize_tolerance)
@@ -433,9 +666,22 @@ namespace Peclet
         
         SolverBicgstab<> solver_bicgstab(solver_control);
 
+        Instrumentation::ScopedTimer preconditioner_timer("preconditioner_setup");
+        
         PreconditionSSOR<> preconditioner;
         
         preconditioner.initialize(this->system_matrix, 1.0);
+        
+        const bool sell = (this->params.solver.matrix_format == "sell_c_sigma");
+        
+        if (sell)
+        { /* The preconditioner still works on the CSR matrix. */
+            this->sell_system_matrix.copy_values_from(this->system_matrix);
+        }
+        
+        preconditioner_timer.stop();
+        
+        Instrumentation::ScopedTimer solver_timer("krylov_solve");
 
         std::string solver_name;
         
@@ -443,23 +689,51 @@ namespace Peclet
         {
             solver_name = "CG";
         
-            solver_cg.solve(
-                this->system_matrix,
-                this->solution,
-                this->system_rhs,
-                preconditioner);    
+            if (sell)
+            {
+                solver_cg.solve(
+                    this->sell_system_matrix,
+                    this->solution,
+                    this->system_rhs,
+                    preconditioner);
+            }
+            else
+            {
+                solver_cg.solve(
+                    this->system_matrix,
+                    this->solution,
+                    this->system_rhs,
+                    preconditioner);
+            }
         }
         else if (this->params.solver.method == "BiCGStab")
         {
             solver_name = "BiCGStab";
             
-            solver_bicgstab.solve(
-                this->system_matrix,
-                this->solution,
-                this->system_rhs,
-                preconditioner);
+            if (sell)
+            {
+                solver_bicgstab.solve(
+                    this->sell_system_matrix,
+                    this->solution,
+                    this->system_rhs,
+                    preconditioner);
+            }
+            else
+            {
+                solver_bicgstab.solve(
+                    this->system_matrix,
+                    this->solution,
+                    this->system_rhs,
+                    preconditioner);
+            }
         }
 
+        solver_timer.stop();
+        
+        Instrumentation::add("solver_iterations", solver_control.last_step());
+        
+        Instrumentation::add("residual", solver_control.last_value());
+
         this->constraints.distribute(this->solution);
 
         if (!quiet)
@@ -477,17 +751,91 @@ namespace Peclet
     }
   
     #include "peclet_1D_solution_table.h"
+    
+    #include "peclet_checkpoint.h"
+    
+    #include "peclet_setup_cache.h"
+    
+    #include "peclet_memory_report.h"
+    
+    #include "peclet_estimate.h"
   
     template<int dim>
     void Peclet<dim>::write_solution()
     {
+        Instrumentation::ScopedTimer timer("write_solution");
           
         if (this->params.output.write_solution_vtk)
         {
-            Output::write_solution_to_vtk(
-                "solution-"+Utilities::int_to_string(this->time_step_counter)+".vtk",
-                this->dof_handler,
-                this->solution);    
+            const std::string format = this->params.output.format;
+            
+            const std::string file_base_name = 
+                "solution-"+Utilities::int_to_string(this->time_step_counter);
+            
+            if (format == "vtk")
+            {
+                Output::write_solution_to_vtk(
+                    file_base_name+".vtk",
+                    this->dof_handler,
+                    this->solution);    
+                    
+                Instrumentation::add_file_size("bytes_written", file_base_name+".vtk");
+            }
+            else if (format == "vtu")
+            {
+                Output::write_solution_to_vtu(
+                    file_base_name+".vtu",
+                    this->dof_handler,
+                    this->solution,
+                    this->time,
+                    this->time_step_counter);
+                    
+                this->vtu_times_and_names.push_back(
+                    std::make_pair(this->time, file_base_name+".vtu"));
+                    
+                Output::write_pvd_record("solution.pvd", this->vtu_times_and_names);
+                
+                Instrumentation::add_file_size("bytes_written", file_base_name+".vtu");
+                
+                Instrumentation::add_file_size("bytes_written", "solution.pvd");
+            }
+            else if (format == "hdf5")
+            {
+#ifdef DEAL_II_WITH_HDF5
+                const bool write_mesh_file = this->mesh_changed_since_output;
+                
+                if (write_mesh_file)
+                {
+                    this->mesh_file_name = 
+                        "mesh-"+Utilities::int_to_string(this->mesh_output_counter)+".h5";
+                    
+                    ++this->mesh_output_counter;
+                }
+                
+                Output::write_solution_to_hdf5(
+                    this->mesh_file_name,
+                    write_mesh_file,
+                    file_base_name+".h5",
+                    "solution.xdmf",
+                    this->time,
+                    this->dof_handler,
+                    this->solution,
+                    this->xdmf_entries);
+                    
+                if (write_mesh_file)
+                {
+                    Instrumentation::add_file_size("bytes_written", this->mesh_file_name);
+                }
+                
+                Instrumentation::add_file_size("bytes_written", file_base_name+".h5");
+                
+                Instrumentation::add_file_size("bytes_written", "solution.xdmf");
+                    
+                this->mesh_changed_since_output = false;
+#else
+                throw std::runtime_error("output.format = hdf5 requires deal.II with HDF5");
+#endif
+            }
         }
         
         if (dim == 1)
@@ -578,16 +926,44 @@ namespace Peclet
         out_file.close(); 
 
     }
+  
+    template<int dim>
+    void Peclet<dim>::write_instrumentation_summary()
+    {
+        if (this->trace_file_path != "")
+        {
+            Tracing::write(this->trace_file_path);
+        }
+        
+        if (!this->params.profiling.enabled)
+        {
+            return;
+        }
+        
+        Instrumentation::add_process_statistics();
+        
+        if (this->params.profiling.summary_format == "csv")
+        {
+            Instrumentation::registry().write_csv(this->params.profiling.summary_file_path);
+        }
+        else
+        {
+            Instrumentation::registry().write_json(this->params.profiling.summary_file_path);
+        }
+    }
 
   template<int dim>
-  void Peclet<dim>::run(const std::string parameter_file)
+  void Peclet<dim>::run(const std::string parameter_file, const bool resume)
   {
     
     /* Clean up the files in the working directory */
     
-    if (dim == 1)
+    if ((dim == 1) && !resume)
     {
-        std::remove(solution_table_1D_file_name.c_str()); // In 1D, the solution will be appended here at every time step.    
+        std::remove(solution_table_1D_file_name.c_str());
+        
+        // In 1D, the solution will be appended here at every output step.
+        SolutionHistory1D::open(this->solution_history_1D, this->solution_history_1D_file_name);
     }        
     
     if (this->params.verification.enabled)
@@ -619,6 +995,29 @@ namespace Peclet
         parsed_exact_solution_function,
         parsed_initial_values_function);
     
+    Instrumentation::registry().enabled = this->params.profiling.enabled;
+    
+    Instrumentation::allocation_counting_enabled() = this->params.profiling.enabled;
+    
+    if (this->params.profiling.enabled && (this->params.profiling.step_file_path != ""))
+    {
+        Instrumentation::registry().open_step_stream(this->params.profiling.step_file_path);
+    }
+    
+    this->trace_file_path = this->params.profiling.trace_file_path;
+    
+    if (std::getenv("PECLET_TRACE_FILE") != NULL)
+    {
+        this->trace_file_path = std::getenv("PECLET_TRACE_FILE");
+    }
+    
+    if (this->trace_file_path != "")
+    {
+        Tracing::enable();
+    }
+    
+    Instrumentation::ScopedTimer run_timer("run");
+    
     this->create_coarse_grid();
     
     this->velocity_function = &parsed_velocity_function;
@@ -636,34 +1035,38 @@ namespace Peclet
         - flexibily implementing general boundary conditions
     */
 
-    /* Initial values function */
-    Triangulation<dim> field_grid;
+    /* Initial values function
     
-    DoFHandler<dim> field_dof_handler(field_grid);
+    Unlike the parsed functions, an old field is expensive to construct, since it must be read from disk
+    and indexed. So it is only constructed if it is actually selected.
     
-    Vector<double> field_solution;
-    
-    if (this->params.initial_values.function_name != "interpolate_old_field")
-    { // This will write files that need to exist.
-        this->setup_system(true);
-        FEFieldTools::save_field_parts(this->triangulation, this->dof_handler, this->solution); 
-    }
+    */
+    std::unique_ptr<Triangulation<dim>> field_grid;
     
-    FEFieldTools::load_field_parts(
-        field_grid,
-        field_dof_handler,
-        field_solution,
-        this->fe);
+    std::unique_ptr<DoFHandler<dim>> field_dof_handler;
     
-    MyFunctions::ExtrapolatedField<dim> field_function(
-        field_dof_handler,
-        field_solution);
+    Vector<double> field_solution;
     
+    std::unique_ptr<MyFunctions::ExtrapolatedField<dim>> field_function;
 
     if (this->params.initial_values.function_name == "interpolate_old_field")
     {
+        field_grid.reset(new Triangulation<dim>());
         
-        this->initial_values_function = &field_function;
+        field_dof_handler.reset(new DoFHandler<dim>(*field_grid));
+        
+        FEFieldTools::load_field(
+            this->params.initial_values.old_field_file_path,
+            *field_grid,
+            *field_dof_handler,
+            field_solution,
+            this->fe);
+        
+        field_function.reset(new MyFunctions::ExtrapolatedField<dim>(
+            *field_dof_handler,
+            field_solution));
+        
+        this->initial_values_function = field_function.get();
         
     }
     else if (this->params.initial_values.function_name == "parsed")
@@ -748,47 +1151,93 @@ namespace Peclet
         }
     }
     
-    /* Run initial grid refinement cycles */
-    this->triangulation.refine_global(this->params.refinement.initial_global_cycles);
+    if (resume)
+    {
+        /* Restore the refined grid, the linear system and the time loop state */
+        this->read_checkpoint();
+    }
+    else if (!(this->params.setup_cache.enabled && this->read_setup_cache()))
+    {
+        this->refine_initial_grid();
+            
+        /* Initialize the linear system and constraints */
+        this->setup_system(); 
+        
+        if (this->params.setup_cache.enabled)
+        {
+            this->write_setup_cache();
+        }
+    }
+    
+    if (!resume)
+    {
+        this->pre_refinement_step = 0;
+    }
     
-    Refinement::refine_mesh_near_boundaries(
-        this->triangulation,
-        this->params.refinement.boundaries_to_refine,
-        this->params.refinement.initial_boundary_cycles);
+    if (this->params.checkpoint.write_on_sigterm)
+    {
+        sigterm_received = 0;
         
-    /* Initialize the linear system and constraints */
-    this->setup_system(); 
+        std::signal(SIGTERM, handle_sigterm);
+    }
 
-    Vector<double> tmp;
+    std::map<types::boundary_id, Function<dim>*> natural_boundary_functions;
     
-    Vector<double> forcing_terms;
+    for (unsigned int boundary = 0; boundary < boundary_count; boundary++)
+    {
+        if (this->params.boundary_conditions.implementation_types[boundary] == "natural")
+        {
+            natural_boundary_functions[boundary] = boundary_functions[boundary];
+        }
+    }
     
     double epsilon = 1e-14;
     
     /* Iterate through time steps
     
-    A goto statement (to the start_time_iteration label) is used to handle pre-refinement.
+    A goto statement (to the start_time_iteration label) is used to handle adaptive pre-refinement.
+    Where the required resolution is known from the data, refinement.a_priori avoids these restarts.
     Generally goto's are a terrible idea; but the step-26 tutorial makes a case for it being instructive here.
     It would probably be better to redesign this without a goto.
     
     */
-    unsigned int pre_refinement_step = 0;
+    bool resuming = resume;
     
 start_time_iteration: 
 
-    tmp.reinit(this->solution.size());
-
-    VectorTools::interpolate(this->dof_handler,
-                             *this->initial_values_function,
-                             this->old_solution); 
-    
-    this->solution = this->old_solution;
-    
-    this->write_solution(); /* Write the initial values */
-    
-    this->time_step_counter = 0;
-    
-    this->time = 0;
+    if (resuming)
+    { /* The checkpoint already restored the solution, time and step counter. */
+        resuming = false;
+    }
+    else
+    {
+        if (this->params.initial_values.function_name == "interpolate_old_field")
+        {
+            /* Transfer all support points at once, or copy the field if the grids are identical. */
+            GridTransfer::interpolate(*field_function, this->dof_handler, this->old_solution);
+        }
+        else
+        {
+            VectorTools::interpolate(this->dof_handler,
+                                     *this->initial_values_function,
+                                     this->old_solution); 
+        }
+        
+        this->solution = this->old_solution;
+        
+        this->time_step_counter = 0;
+        
+        this->time = 0;
+        
+        /* Pre-refinement restarts the time loop, so records of earlier output steps are obsolete. */
+        this->vtu_times_and_names.clear();
+        
+#ifdef DEAL_II_WITH_HDF5
+        this->xdmf_entries.clear();
+#endif
+        
+        this->write_solution(); /* Write the initial values */
+    }
     
     double theta = this->params.time.semi_implicit_theta;
     
@@ -810,6 +1259,8 @@ start_time_iteration:
     
     do
     {
+        Instrumentation::ScopedTimer step_timer("time_step");
+        
         ++this->time_step_counter;
         
         /* Typically you see something more like "time += Delta_t" in time-dependent codes,
@@ -853,84 +1304,74 @@ start_time_iteration:
                 << " at t=" << this->time << std::endl;    
         }
 
-        /* Add mass and convection-diffusion matrix terms to the RHS. */
-        this->mass_matrix.vmult(this->system_rhs, this->old_solution);
-
-        this->convection_diffusion_matrix.vmult(tmp, this->old_solution);
+        const bool sell = (this->params.solver.matrix_format == "sell_c_sigma");
         
-        this->system_rhs.add(-(1. - theta)*Delta_t, tmp);
-        
-        /* Add source/forcing terms to the RHS. */
-        source_function->set_time(this->time);
-        
-        VectorTools::create_right_hand_side(
-            this->dof_handler,
-            QGauss<dim>(fe.degree+1),
-            *source_function,
-            tmp);
-        
-        forcing_terms = tmp;
-        
-        forcing_terms *= Delta_t*theta;
-        
-        source_function->set_time(this->time - Delta_t);
-        
-        VectorTools::create_right_hand_side(
-            this->dof_handler,
-            QGauss<dim>(fe.degree + 1),
-            *source_function,
-            tmp);
-        
-        forcing_terms.add(Delta_t*(1 - theta), tmp);
-        
-        this->system_rhs += forcing_terms;
-        
-        /* Add natural boundary conditions to RHS */
-        for (unsigned int boundary = 0; boundary < boundary_count; boundary++)
+        if (this->explicit_matrix_outdated || (this->explicit_matrix_time_step_size != Delta_t))
         {
-            if ((this->params.boundary_conditions.implementation_types[boundary] != "natural"))
-            {
-                continue;
-            }
+            Instrumentation::ScopedTimer explicit_timer("assemble_explicit_matrix");
             
-            std::set<types::boundary_id> dealii_boundary_id = {boundary}; /* @todo: This throws a warning */
+            this->explicit_matrix.reinit(this->sparsity_pattern);
             
-            boundary_functions[boundary]->set_time(this->time);
+            this->explicit_matrix.copy_from(this->mass_matrix);
             
-            MyVectorTools::my_create_boundary_right_hand_side(
-                this->dof_handler,
-                QGauss<dim-1>(fe.degree + 1),
-                *boundary_functions[boundary],
-                tmp,
-                dealii_boundary_id);
-                
-            forcing_terms = tmp;
+            this->explicit_matrix.add(-(1. - theta)*Delta_t, this->convection_diffusion_matrix);
             
-            forcing_terms *= Delta_t*theta;
+            if (sell)
+            { /* Both matrices have the same sparsity pattern. The values of the system matrix are copied every step. */
+                this->sell_explicit_matrix.reinit(this->explicit_matrix);
                 
-            boundary_functions[boundary]->set_time(this->time - Delta_t);
+                this->sell_system_matrix.reinit(this->explicit_matrix);
+                
+                Instrumentation::add("sell_c_sigma_fill_ratio", this->sell_explicit_matrix.fill_ratio());
+            }
             
-            MyVectorTools::my_create_boundary_right_hand_side(
-                this->dof_handler,
-                QGauss<dim-1>(fe.degree + 1),
-                *boundary_functions[boundary],
-                tmp,
-                dealii_boundary_id);
-             
-            forcing_terms.add(Delta_t*(1. - theta), tmp);
+            this->explicit_matrix_time_step_size = Delta_t;
             
-            this->system_rhs += forcing_terms;
-
+            this->explicit_matrix_outdated = false;
         }
         
+        /* Add the old solution's terms to the RHS, and accumulate the source and natural boundary terms
+        of both time levels onto them in one sweep over the cells. */
+        Instrumentation::ScopedTimer rhs_timer("assemble_rhs");
+        
+        if (sell)
+        {
+            this->sell_explicit_matrix.vmult(this->system_rhs, this->old_solution);
+        }
+        else
+        {
+            this->explicit_matrix.vmult(this->system_rhs, this->old_solution);
+        }
+        
+        MyVectorTools::add_theta_forcing_right_hand_side(
+            this->dof_handler,
+            QGauss<dim>(fe.degree + 1),
+            QGauss<dim-1>(fe.degree + 1),
+            *source_function,
+            natural_boundary_functions,
+            (this->params.stabilization.method == "supg") ? this->velocity_function : nullptr,
+            *this->diffusivity_function,
+            this->time,
+            Delta_t,
+            theta,
+            this->system_rhs);
+        
+        rhs_timer.stop();
+        
         /* Make the system matrix and apply constraints. */
+        Instrumentation::ScopedTimer matrix_timer("assemble_system_matrix");
+        
         system_matrix.copy_from(mass_matrix);
         
         system_matrix.add(theta*Delta_t, convection_diffusion_matrix);
 
         constraints.condense(system_matrix, system_rhs);
+        
+        matrix_timer.stop();
 
         {
+            Instrumentation::ScopedTimer boundary_timer("apply_boundary_values");
+            
             /* Apply strong boundary conditions */
             std::map<types::global_dof_index, double> boundary_values;
             
@@ -993,8 +1434,6 @@ start_time_iteration:
             
             ++pre_refinement_step;
 
-            tmp.reinit(this->solution.size());
-
             std::cout << std::endl;
 
             goto start_time_iteration;
@@ -1008,19 +1447,52 @@ start_time_iteration:
             for (unsigned int cycle = 0;
                  cycle < params.refinement.adaptive.cycles_at_interval; cycle++)
             {
-                this->adaptive_refine();
+                this->adaptive_refine(cycle + 1 < params.refinement.adaptive.cycles_at_interval);
             }
             
-            tmp.reinit(this->solution.size());
-            
         }
         
         this->old_solution = this->solution;
         
+        /* Write a checkpoint periodically, or before stopping after SIGTERM. */
+        const bool terminating = (sigterm_received != 0);
+        
+        if (terminating ||
+            ((this->params.checkpoint.interval > 0)
+             && (time_step_counter % this->params.checkpoint.interval == 0)
+             && !final_time_step))
+        {
+            this->write_checkpoint();
+        }
+        
+        if (terminating && !final_time_step)
+        {
+            std::cout << "Received SIGTERM. Wrote checkpoint " << this->params.checkpoint.file_path
+                << " at time step " << this->time_step_counter << ", t=" << this->time << std::endl;
+            
+            this->triangulation.set_manifold(0);
+            
+            step_timer.stop();
+            
+            run_timer.stop();
+            
+            this->write_memory_report("exit");
+            
+            this->write_instrumentation_summary();
+            
+            return;
+        }
+        
+        step_timer.stop();
+        
+        Instrumentation::registry().write_step(this->time_step_counter, this->time);
+        
     } while (!final_time_step);
     
     /* Write FEFieldFunction related data so that it can be used as initial values for another run. */
-    FEFieldTools::save_field_parts(triangulation, dof_handler, solution);
+    FEFieldTools::save_field(this->params.output.field_file_path, triangulation, dof_handler, solution);
+    
+    Instrumentation::add_file_size("bytes_written", this->params.output.field_file_path);
     
     /* Write the convergence/verification table. */
     if (this->params.verification.enabled)
@@ -1028,8 +1500,8 @@ start_time_iteration:
         this->write_verification_table();
     }
     
-    /* Write the 1D solution table */
-    if (dim == 1)
+    /* Export the 1D solution table */
+    if ((dim == 1) && this->params.output.write_solution_table)
     {
         this->write_1D_solution_table(this->solution_table_1D_file_name);
     }
@@ -1041,6 +1513,12 @@ start_time_iteration:
     */
     this->triangulation.set_manifold(0);
     
+    run_timer.stop();
+    
+    this->write_memory_report("exit");
+    
+    this->write_instrumentation_summary();
+    
     }
     
 }
@@ -0,0 +1,196 @@
+/*
+Checkpoints contain the full state of the time loop, so that an interrupted run can continue
+exactly where it left off, via Peclet::run(parameter_file, true), i.e. peclet --resume.
+
+The triangulation is stored with deal.II's own serialization, which preserves the cell and vertex
+ordering. The DoF numbering, the assembled matrices and therefore every later time step are then
+bit-for-bit identical to those of the uninterrupted run.
+
+The container format is the same as for the restart files written by FEFieldTools::save_field,
+but with a different magic string.
+*/
+
+const char CHECKPOINT_MAGIC[8] = {'P', 'E', 'C', 'L', 'E', 'T', 'C', 'P'};
+
+/*! This is set by the SIGTERM handler and checked at the end of every time step. */
+static volatile std::sig_atomic_t sigterm_received = 0;
+
+static void handle_sigterm(int)
+{
+    sigterm_received = 1;
+}
+
+template<int dim>
+void Peclet<dim>::write_checkpoint()
+{
+    Instrumentation::ScopedTimer timer("write_checkpoint");
+    
+    FEFieldTools::Writer payload;
+    
+    payload.write(this->time);
+    
+    payload.write(this->time_step_size);
+    
+    payload.write(std::uint32_t(this->time_step_counter));
+    
+    payload.write(std::uint32_t(this->pre_refinement_step));
+    
+    {
+        std::ostringstream archive_stream;
+        
+        {
+            boost::archive::binary_oarchive archive(archive_stream);
+            
+            archive << this->triangulation;
+            
+            archive << this->verification_table;
+        }
+        
+        payload.write(archive_stream.str());
+    }
+    
+    for (Vector<double> *vector : {&this->solution, &this->old_solution})
+    {
+        payload.write(std::uint64_t(vector->size()));
+        
+        payload.write(vector->begin(), vector->size());
+    }
+    
+    payload.write(std::uint64_t(this->vtu_times_and_names.size()));
+    
+    for (auto &time_and_name : this->vtu_times_and_names)
+    {
+        payload.write(time_and_name.first);
+        
+        payload.write(time_and_name.second);
+    }
+    
+    /* The HDF5 output state, so that the resumed run continues the XDMF time series and mesh file names */
+    payload.write(std::uint32_t(this->mesh_output_counter));
+    
+    payload.write(this->mesh_file_name);
+    
+    payload.write(std::uint32_t(this->mesh_changed_since_output));
+    
+    {
+        std::ostringstream archive_stream;
+        
+#ifdef DEAL_II_WITH_HDF5
+        {
+            boost::archive::binary_oarchive archive(archive_stream);
+            
+            archive << this->xdmf_entries;
+        }
+#endif
+        
+        payload.write(archive_stream.str());
+    }
+    
+    std::uint64_t solution_history_1D_size = 0;
+    
+    if (this->solution_history_1D.is_open())
+    {
+        solution_history_1D_size = this->solution_history_1D.tellp();
+    }
+    
+    payload.write(solution_history_1D_size);
+    
+    FEFieldTools::Header header;
+    
+    header.dim = dim;
+    
+    header.solution_offset = 0;
+    
+    header.n_dofs = this->dof_handler.n_dofs();
+    
+    FEFieldTools::write_file(this->params.checkpoint.file_path, header, payload, CHECKPOINT_MAGIC);
+    
+    Instrumentation::add_file_size("bytes_written", this->params.checkpoint.file_path);
+}
+
+template<int dim>
+void Peclet<dim>::read_checkpoint()
+{
+    const std::string file_path = this->params.checkpoint.file_path;
+    
+    FEFieldTools::MappedFile file(file_path);
+    
+    FEFieldTools::Header header = FEFieldTools::read_header(file, file_path, dim, CHECKPOINT_MAGIC);
+    
+    FEFieldTools::Reader reader(file.data + sizeof(FEFieldTools::Header), header.payload_size);
+    
+    this->time = reader.read<double>();
+    
+    this->time_step_size = reader.read<double>();
+    
+    this->time_step_counter = reader.read<std::uint32_t>();
+    
+    this->pre_refinement_step = reader.read<std::uint32_t>();
+    
+    {
+        std::istringstream archive_stream(reader.read_string());
+        
+        boost::archive::binary_iarchive archive(archive_stream);
+        
+        archive >> this->triangulation;
+        
+        archive >> this->verification_table;
+    }
+    
+    this->setup_system();
+    
+    for (Vector<double> *vector : {&this->solution, &this->old_solution})
+    {
+        if (reader.read<std::uint64_t>() != vector->size())
+        {
+            throw std::runtime_error("The checkpoint " + file_path + " is inconsistent");
+        }
+        
+        reader.read(vector->begin(), vector->size());
+    }
+    
+    this->vtu_times_and_names.resize(reader.read<std::uint64_t>());
+    
+    for (auto &time_and_name : this->vtu_times_and_names)
+    {
+        time_and_name.first = reader.read<double>();
+        
+        time_and_name.second = reader.read_string();
+    }
+    
+    /* This must follow setup_system(), which marks the mesh as changed. */
+    this->mesh_output_counter = reader.read<std::uint32_t>();
+    
+    this->mesh_file_name = reader.read_string();
+    
+    this->mesh_changed_since_output = reader.read<std::uint32_t>() != 0;
+    
+    {
+        const std::string xdmf_archive = reader.read_string();
+        
+#ifdef DEAL_II_WITH_HDF5
+        this->xdmf_entries.clear();
+        
+        if (!xdmf_archive.empty())
+        {
+            std::istringstream archive_stream(xdmf_archive);
+            
+            boost::archive::binary_iarchive archive(archive_stream);
+            
+            archive >> this->xdmf_entries;
+        }
+#endif
+    }
+    
+    const std::uint64_t solution_history_1D_size = reader.read<std::uint64_t>();
+    
+    if (dim == 1)
+    {
+        /* Discard anything written after the checkpoint, since it will be written again. */
+        SolutionHistory1D::reopen(this->solution_history_1D, this->solution_history_1D_file_name,
+            solution_history_1D_size);
+    }
+    
+    std::cout << "Resumed from " << file_path << " at time step " << this->time_step_counter
+        << ", t=" << this->time << std::endl;
+}
@@ -0,0 +1,511 @@
+/*
+A dry run, i.e. peclet --estimate, predicts the size and cost of a run from its parameter file,
+so that jobs can be sized before they are queued.
+
+The coarse grid and the initial refinement are built exactly as for the run, and the DoFs and
+the sparsity pattern are counted, but nothing is assembled or solved on this grid.
+Memory is then predicted from the sizes of the data structures which setup_system and the time loop allocate.
+
+The time per step is calibrated on this machine, with the same threads, by timing the kernels of one
+time step on a unit hyper_cube of at most CALIBRATION_CELLS cells, with the same element, functions, time step size,
+stabilization, matrix format and solver. The times are scaled with the number of cells or matrix nonzeros.
+The short kernels are timed by the minimum of several runs after a warm-up run, see CALIBRATION_REPETITIONS.
+The number of Krylov iterations is scaled with the square root of the estimated condition number of M + theta Delta_t K, which grows as 1/h^2.
+This neglects convection, so it is only a rough guide for convection-dominated problems.
+
+Adaptive refinement during the time loop is not predicted.
+*/
+
+/*! The per-step costs measured on the calibration grid */
+struct CostCalibration
+{
+    unsigned int cells;
+    double min_cell_size;
+    double max_diffusivity;
+    double rhs_seconds_per_cell;
+    double spmv_seconds_per_nonzero;
+    double sell_fill_ratio;
+    double matrix_seconds_per_nonzero;
+    double iteration_seconds_per_nonzero;
+    double iterations;
+    double output_seconds_per_cell;
+    double output_bytes_per_cell;
+};
+
+const unsigned int CALIBRATION_CELLS = 1 << 14;
+
+/*! The number of timed runs of each of the SpMV, right hand side and matrix kernels, after one untimed warm-up run */
+const unsigned int CALIBRATION_REPETITIONS = 5;
+
+template<int dim>
+CostCalibration calibrate_costs(
+    const FE_Q<dim> &fe,
+    const Parameters::StructuredParameters &params,
+    const double time_step_size,
+    const unsigned int max_cells,
+    const Function<dim> &velocity_function,
+    const Function<dim> &diffusivity_function,
+    Function<dim> &source_function)
+{
+    CostCalibration calibration;
+
+    auto seconds_since = [](const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    /* The first run pays for page faults and cold caches, and noise from other processes only ever adds time,
+    so a kernel is timed by the minimum of several runs after a warm-up run. */
+    auto min_seconds = [&seconds_since](const std::function<void()> &kernel)
+    {
+        kernel();
+
+        double seconds = std::numeric_limits<double>::max();
+
+        for (unsigned int repetition = 0; repetition < CALIBRATION_REPETITIONS; ++repetition)
+        {
+            const auto start = std::chrono::steady_clock::now();
+
+            kernel();
+
+            seconds = std::min(seconds, seconds_since(start));
+        }
+
+        return seconds;
+    };
+
+    Triangulation<dim> triangulation;
+
+    GridGenerator::hyper_cube(triangulation);
+
+    const unsigned int cells = std::max(std::min(max_cells, CALIBRATION_CELLS), 1u << dim);
+
+    triangulation.refine_global(std::max(1, int(std::log2(double(cells))/dim)));
+
+    calibration.cells = triangulation.n_active_cells();
+
+    calibration.min_cell_size = GridTools::minimal_cell_diameter(triangulation)/std::sqrt(double(dim));
+
+    DoFHandler<dim> dof_handler(triangulation);
+
+    dof_handler.distribute_dofs(fe);
+
+    DynamicSparsityPattern dsp(dof_handler.n_dofs());
+
+    DoFTools::make_sparsity_pattern(dof_handler, dsp);
+
+    SparsityPattern sparsity_pattern;
+
+    sparsity_pattern.copy_from(dsp);
+
+    const double nonzeros = sparsity_pattern.n_nonzero_elements();
+
+    SparseMatrix<double> mass_matrix(sparsity_pattern),
+        convection_diffusion_matrix(sparsity_pattern),
+        explicit_matrix(sparsity_pattern),
+        system_matrix(sparsity_pattern);
+
+    const QGauss<dim> quadrature(fe.degree + 1);
+
+    /* The matrices, with the SUPG terms as in Peclet::setup_system */
+    const bool supg = (params.stabilization.method == "supg");
+
+    if (supg)
+    {
+        MyMatrixCreator::CellMatrixCache cache;
+
+        MyMatrixCreator::create_mass_and_convection_diffusion_matrices<dim>(dof_handler, quadrature,
+            mass_matrix, convection_diffusion_matrix, &diffusivity_function, &velocity_function, cache, true);
+    }
+    else
+    {
+        MatrixCreator::create_mass_matrix(dof_handler, quadrature, mass_matrix);
+
+        MyMatrixCreator::create_convection_diffusion_matrix<dim>(dof_handler, quadrature,
+            convection_diffusion_matrix, &diffusivity_function, &velocity_function);
+    }
+
+    calibration.max_diffusivity = 0.;
+
+    for (auto cell : triangulation.active_cell_iterators())
+    {
+        calibration.max_diffusivity = std::max(calibration.max_diffusivity,
+            diffusivity_function.value(cell->center()));
+    }
+
+    Vector<double> solution(dof_handler.n_dofs()), rhs(dof_handler.n_dofs());
+
+    const double theta = params.time.semi_implicit_theta;
+
+    explicit_matrix.copy_from(mass_matrix);
+
+    explicit_matrix.add(-(1. - theta)*time_step_size, convection_diffusion_matrix);
+
+    const bool sell = (params.solver.matrix_format == "sell_c_sigma");
+
+    SellCSigma::Matrix sell_explicit_matrix, sell_system_matrix;
+
+    calibration.sell_fill_ratio = 1.;
+
+    if (sell)
+    { /* The structure is copied only when the grid or the time step size changes, so this is not timed. */
+        sell_explicit_matrix.reinit(explicit_matrix);
+
+        sell_system_matrix.reinit(explicit_matrix);
+
+        calibration.sell_fill_ratio = sell_explicit_matrix.fill_ratio();
+    }
+
+    /* The explicit part of the theta-scheme, in the matrix format of the run */
+    solution = 1.;
+
+    calibration.spmv_seconds_per_nonzero = min_seconds([&]()
+    {
+        if (sell)
+        {
+            sell_explicit_matrix.vmult(rhs, solution);
+        }
+        else
+        {
+            explicit_matrix.vmult(rhs, solution);
+        }
+    })/nonzeros;
+
+    /* The source and natural boundary terms of both time levels, in the single sweep of the time loop.
+    The calibration grid has no natural boundaries, whose faces are a small part of the sweep. */
+    const std::map<types::boundary_id, Function<dim>*> no_boundary_functions;
+
+    calibration.rhs_seconds_per_cell = min_seconds([&]()
+    {
+        MyVectorTools::add_theta_forcing_right_hand_side(dof_handler, quadrature, QGauss<dim-1>(fe.degree + 1),
+            source_function, no_boundary_functions, supg ? &velocity_function : nullptr, diffusivity_function,
+            time_step_size, time_step_size, theta, rhs);
+    })/calibration.cells;
+
+    /* The system matrix, and its copy for the solver */
+    calibration.matrix_seconds_per_nonzero = min_seconds([&]()
+    {
+        system_matrix.copy_from(mass_matrix);
+
+        system_matrix.add(theta*time_step_size, convection_diffusion_matrix);
+
+        if (sell)
+        {
+            sell_system_matrix.copy_values_from(system_matrix);
+        }
+    })/nonzeros;
+
+    /* The solve, as in Peclet::solve_time_step */
+    mass_matrix.vmult(rhs, solution);
+
+    solution = 0.;
+
+    double tolerance = params.solver.tolerance;
+
+    if (params.solver.normalize_tolerance)
+    {
+        tolerance *= rhs.l2_norm();
+    }
+
+    SolverControl solver_control(params.solver.max_iterations, tolerance);
+
+    /* The solve runs many iterations, so it is timed once. */
+    auto start = std::chrono::steady_clock::now();
+
+    PreconditionSSOR<> preconditioner;
+
+    preconditioner.initialize(system_matrix, 1.0);
+
+    try
+    {
+        if (params.solver.method == "CG")
+        {
+            SolverCG<> solver(solver_control);
+
+            if (sell)
+            {
+                solver.solve(sell_system_matrix, solution, rhs, preconditioner);
+            }
+            else
+            {
+                solver.solve(system_matrix, solution, rhs, preconditioner);
+            }
+        }
+        else
+        {
+            SolverBicgstab<> solver(solver_control);
+
+            if (sell)
+            {
+                solver.solve(sell_system_matrix, solution, rhs, preconditioner);
+            }
+            else
+            {
+                solver.solve(system_matrix, solution, rhs, preconditioner);
+            }
+        }
+    }
+    catch (SolverControl::NoConvergence &)
+    {
+        /* The time per iteration is still valid. */
+    }
+
+    calibration.iterations = std::max(1u, solver_control.last_step());
+
+    calibration.iteration_seconds_per_nonzero = seconds_since(start)/(calibration.iterations*nonzeros);
+
+    /* Output, in the selected format */
+    calibration.output_seconds_per_cell = 0.;
+
+    calibration.output_bytes_per_cell = 0.;
+
+    if (params.output.write_solution_vtk
+        && ((params.output.format == "vtk") || (params.output.format == "vtu")))
+    {
+        const std::string file_name = "peclet_estimate_calibration." + params.output.format;
+
+        start = std::chrono::steady_clock::now();
+
+        if (params.output.format == "vtk")
+        {
+            Output::write_solution_to_vtk(file_name, dof_handler, solution);
+        }
+        else
+        {
+            Output::write_solution_to_vtu(file_name, dof_handler, solution, 0., 0);
+        }
+
+        calibration.output_seconds_per_cell = seconds_since(start)/calibration.cells;
+
+        struct stat file_status;
+
+        if (stat(file_name.c_str(), &file_status) == 0)
+        {
+            calibration.output_bytes_per_cell = double(file_status.st_size)/calibration.cells;
+        }
+
+        std::remove(file_name.c_str());
+    }
+
+    return calibration;
+}
+
+template<int dim>
+void Peclet<dim>::estimate(const std::string parameter_file)
+{
+    Functions::ParsedFunction<dim> parsed_velocity_function(dim),
+        parsed_diffusivity_function,
+        parsed_source_function,
+        parsed_boundary_function,
+        parsed_initial_values_function,
+        parsed_exact_solution_function;
+
+    this->params = Parameters::read<dim>(
+        parameter_file,
+        parsed_velocity_function,
+        parsed_diffusivity_function,
+        parsed_source_function,
+        parsed_boundary_function,
+        parsed_exact_solution_function,
+        parsed_initial_values_function);
+
+    this->create_coarse_grid();
+
+    this->velocity_function = &parsed_velocity_function;
+
+    this->diffusivity_function = &parsed_diffusivity_function;
+
+    this->source_function = &parsed_source_function;
+
+    /* An old field is not loaded, since that can be expensive, so it can not guide a priori refinement. */
+    this->initial_values_function = NULL;
+
+    if (this->params.initial_values.function_name == "parsed")
+    {
+        this->initial_values_function = &parsed_initial_values_function;
+    }
+
+    SphericalManifold<dim> spherical_manifold(this->spherical_manifold_center);
+
+    for (unsigned int i = 0; i < manifold_ids.size(); i++)
+    {
+        if (manifold_descriptors[i] == "spherical")
+        {
+            this->triangulation.set_manifold(manifold_ids[i], spherical_manifold);
+        }
+    }
+
+    this->refine_initial_grid();
+
+    /* Count the DoFs and nonzeros as setup_system would */
+    this->dof_handler.distribute_dofs(this->fe);
+
+    this->constraints.clear();
+
+    DoFTools::make_hanging_node_constraints(this->dof_handler, this->constraints);
+
+    this->constraints.close();
+
+    DynamicSparsityPattern dsp(this->dof_handler.n_dofs());
+
+    DoFTools::make_sparsity_pattern(this->dof_handler, dsp, this->constraints, true);
+
+    const double n_dofs = this->dof_handler.n_dofs();
+
+    const double n_cells = this->triangulation.n_active_cells();
+
+    const double nonzeros = dsp.n_nonzero_elements();
+
+    /* Time steps and output steps, as in the time loop */
+    double time_step_size = this->params.time.step_size;
+
+    if (time_step_size < EPSILON)
+    {
+        time_step_size = this->params.time.end_time/pow(2., this->params.time.global_refinement_levels);
+    }
+
+    const unsigned int time_steps = std::ceil(this->params.time.end_time/time_step_size - 1.e-8);
+
+    const int interval = this->params.output.time_step_interval;
+
+    /* The initial values and the final step are always written. */
+    const unsigned int output_steps = 1 + ((interval > 0) ? time_steps/interval : 0)
+        + (((interval <= 0) || ((time_steps % interval) != 0)) ? 1 : 0);
+
+    CostCalibration calibration = calibrate_costs<dim>(
+        this->fe, this->params, time_step_size, this->triangulation.n_active_cells(),
+        *this->velocity_function, *this->diffusivity_function, *this->source_function);
+
+    /* Memory of the data structures which setup_system and the time loop allocate */
+    const bool adaptive = (this->params.refinement.adaptive.initial_cycles > 0)
+        || (this->params.refinement.adaptive.interval > 0);
+
+    const double dofs_per_cell = this->fe.dofs_per_cell;
+
+    const double solver_vectors = (this->params.solver.method == "CG") ? 3. : 7.;
+
+    const std::vector<std::pair<std::string, double>> memory = {
+        {"triangulation", double(this->triangulation.memory_consumption())},
+        {"dof_handler", double(this->dof_handler.memory_consumption())},
+        {"constraints", double(this->constraints.memory_consumption())},
+        {"sparsity_pattern", nonzeros*sizeof(types::global_dof_index) + (n_dofs + 1)*sizeof(std::size_t)},
+        /* M, C + K, the explicit-side operator and the system matrix, and with SELL-C-sigma the padded copies
+        of the latter two, with 32-bit column indices, padded with the fill ratio of the calibration grid */
+        {"matrices", 4.*nonzeros*sizeof(double)
+            + ((this->params.solver.matrix_format == "sell_c_sigma") ?
+                2.*(nonzeros/calibration.sell_fill_ratio*(sizeof(double) + sizeof(unsigned int))
+                    + n_dofs*(sizeof(unsigned int) + sizeof(std::size_t)/SellCSigma::chunk_size)) : 0.)},
+        {"cell_matrix_cache", (adaptive && this->params.refinement.adaptive.cache_cell_matrices) ?
+            n_cells*2.*dofs_per_cell*dofs_per_cell*sizeof(double) : 0.},
+        /* solution, old_solution and system_rhs */
+        {"vectors", 3.*n_dofs*sizeof(double)},
+        /* The Krylov vectors, and the diagonal positions of the SSOR preconditioner */
+        {"solver_workspace", solver_vectors*n_dofs*sizeof(double) + n_dofs*sizeof(std::size_t)}};
+
+    /* Output volume of one output step */
+    const double vertices_per_cell = GeometryInfo<dim>::vertices_per_cell;
+
+    double output_bytes_per_step = 0.;
+
+    if (this->params.output.write_solution_vtk)
+    {
+        if (this->params.output.format == "hdf5")
+        { /* The values at the nodes. The mesh, with coordinates and connectivity, is written again only when it changes. */
+            output_bytes_per_step = n_cells*vertices_per_cell*sizeof(double);
+        }
+        else
+        {
+            output_bytes_per_step = n_cells*calibration.output_bytes_per_cell;
+        }
+    }
+
+    if (dim == 1)
+    { /* The 1D solution history has the position and value of every support point */
+        output_bytes_per_step += 2.*n_dofs*sizeof(double);
+    }
+
+    /* Time per step */
+    const double theta = this->params.time.semi_implicit_theta;
+
+    const double h = GridTools::minimal_cell_diameter(this->triangulation)/std::sqrt(double(dim));
+
+    auto condition_number = [&](const double cell_size)
+    {
+        return 1. + theta*time_step_size*calibration.max_diffusivity*4.*dim/(cell_size*cell_size);
+    };
+
+    const double iterations = std::min(double(this->params.solver.max_iterations),
+        calibration.iterations*std::sqrt(condition_number(h)/condition_number(calibration.min_cell_size)));
+
+    const double step_seconds = n_cells*calibration.rhs_seconds_per_cell
+        + nonzeros*calibration.spmv_seconds_per_nonzero
+        + nonzeros*calibration.matrix_seconds_per_nonzero
+        + iterations*nonzeros*calibration.iteration_seconds_per_nonzero;
+
+    const double output_seconds = n_cells*calibration.output_seconds_per_cell;
+
+    const double total_seconds = time_steps*step_seconds + output_steps*output_seconds;
+
+    /* Report */
+    const double megabyte = 1024.*1024.;
+
+    auto line = [](const std::string &name)
+    {
+        std::cout << "    " << std::left << std::setw(36) << name << std::right << std::setw(16);
+    };
+
+    std::cout << std::fixed << std::setprecision(0)
+        << "Estimate of the run for " << (parameter_file == "" ? "the default parameters" : parameter_file)
+        << std::endl;
+
+    line("active cells"); std::cout << n_cells << std::endl;
+
+    line("degrees of freedom"); std::cout << n_dofs << std::endl;
+
+    line("matrix nonzeros"); std::cout << nonzeros << std::endl;
+
+    line("time steps"); std::cout << time_steps << std::endl;
+
+    line("output steps"); std::cout << output_steps << std::endl;
+
+    std::cout << std::setprecision(3) << "Predicted memory" << std::endl;
+
+    double total_bytes = 0.;
+
+    for (auto &item : memory)
+    {
+        line(item.first); std::cout << item.second/megabyte << " MB" << std::endl;
+
+        total_bytes += item.second;
+    }
+
+    line("total"); std::cout << total_bytes/megabyte << " MB" << std::endl;
+
+    std::cout << "Predicted output" << std::endl;
+
+    line("per output step"); std::cout << output_bytes_per_step/megabyte << " MB" << std::endl;
+
+    line("total"); std::cout << output_steps*output_bytes_per_step/megabyte << " MB" << std::endl;
+
+    std::cout << "Predicted time, calibrated on " << calibration.cells << " cells" << std::endl;
+
+    line("Krylov iterations per step"); std::cout << std::setprecision(0) << iterations << std::endl;
+
+    line("per time step"); std::cout << std::setprecision(3) << step_seconds << " s" << std::endl;
+
+    line("per output step"); std::cout << output_seconds << " s" << std::endl;
+
+    line("total"); std::cout << total_seconds << " s" << std::endl;
+
+    if (adaptive)
+    {
+        std::cout << "Adaptive refinement will change the grid during the run, which is not predicted." << std::endl;
+    }
+
+    std::cout.unsetf(std::ios_base::floatfield);
+
+    std::cout << std::setprecision(6);
+
+    /* Manifolds must be detached from Triangulations before leaving this scope. */
+    this->triangulation.set_manifold(0);
+}
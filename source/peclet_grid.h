@@ -46,24 +46,77 @@ void Peclet<3>::create_coarse_grid()
 }
 
 template<int dim>
-void Peclet<dim>::adaptive_refine()
+void Peclet<dim>::adaptive_refine(const bool transfer_old_solution)
 {
-    SolutionTransfer<dim> solution_trans(this->dof_handler);
-    Vector<double> previous_solution;
-    previous_solution = this->solution;
-    Refinement::adaptive_refine_mesh(
-        this->triangulation,
+    Instrumentation::ScopedTimer timer("adaptive_refine");
+    if (this->params.refinement.adaptive.error_estimator == "kelly")
+    {
+        SolutionTransfer<dim> solution_trans(this->dof_handler);
+        Vector<double> previous_solution;
+        previous_solution = this->solution;
+        Refinement::adaptive_refine_mesh(
+            this->triangulation,
+            this->dof_handler,
+            this->solution,
+            solution_trans,
+            this->fe,
+            this->params.refinement.initial_global_cycles + params.refinement.initial_boundary_cycles,
+            this->params.refinement.adaptive.max_level,
+            this->params.refinement.adaptive.max_cells,
+            this->params.refinement.adaptive.refine_fraction,
+            this->params.refinement.adaptive.coarsen_fraction);
+        this->setup_system();
+        solution_trans.interpolate(previous_solution, this->solution);
+        this->constraints.distribute(this->solution);
+        return;
+    }
+    
+    /* The residual includes the time derivative, so it is estimated from the solution and the old solution.
+    run() sets the old solution to the solution after refining, so the old solution is only transferred
+    to the new grid if another refinement cycle follows, which needs it for its estimate. */
+    Assert(this->params.refinement.adaptive.error_estimator == "residual", ExcNotImplemented());
+    this->velocity_function->set_time(this->time);
+    this->diffusivity_function->set_time(this->time);
+    this->source_function->set_time(this->time);
+    Vector<float> estimated_error_per_cell;
+    ResidualErrorEstimator::estimate(
         this->dof_handler,
+        QGauss<dim>(fe.degree+1),
+        QGauss<dim-1>(fe.degree+1),
         this->solution,
-        solution_trans,
-        this->fe,
+        this->old_solution,
+        this->time_step_size,
+        *this->velocity_function,
+        *this->diffusivity_function,
+        *this->source_function,
+        estimated_error_per_cell);
+    Refinement::flag_cells_for_refinement(
+        this->triangulation,
+        estimated_error_per_cell,
         this->params.refinement.initial_global_cycles + params.refinement.initial_boundary_cycles,
         this->params.refinement.adaptive.max_level,
         this->params.refinement.adaptive.max_cells,
         this->params.refinement.adaptive.refine_fraction,
         this->params.refinement.adaptive.coarsen_fraction);
+    SolutionTransfer<dim> solution_trans(this->dof_handler);
+    std::vector<Vector<double>> previous_solutions(transfer_old_solution ? 2 : 1);
+    previous_solutions[0] = this->solution;
+    if (transfer_old_solution)
+    {
+        previous_solutions[1] = this->old_solution;
+    }
+    this->triangulation.prepare_coarsening_and_refinement();
+    solution_trans.prepare_for_coarsening_and_refinement(previous_solutions);
+    this->triangulation.execute_coarsening_and_refinement();
     this->setup_system();
-    solution_trans.interpolate(previous_solution, this->solution);
+    std::vector<Vector<double>> solutions(previous_solutions.size(), Vector<double>(this->dof_handler.n_dofs()));
+    solution_trans.interpolate(previous_solutions, solutions);
+    this->solution = solutions[0];
     this->constraints.distribute(this->solution);
+    if (transfer_old_solution)
+    {
+        this->old_solution = solutions[1];
+        this->constraints.distribute(this->old_solution);
+    }
 }
   
\ No newline at end of file
@@ -0,0 +1,91 @@
+/*
+The memory report breaks down the bytes used by each of the large data structures,
+as reported by their memory_consumption() methods, so that one can see what fills the memory
+on a refined grid and size jobs accordingly.
+
+The tracked total does not include the heap fragmentation, the deal.II and MPI libraries,
+or temporaries which only exist inside of a function, e.g. DataOut during write_solution.
+Comparing it to the resident set size shows how large these are.
+The peak resident set size is sampled with every report, and included in the instrumentation summary.
+*/
+
+template<int dim>
+void Peclet<dim>::write_memory_report(const std::string label)
+{
+    if (!this->params.profiling.memory_report)
+    {
+        return;
+    }
+
+    std::size_t cell_matrix_cache_bytes = 0;
+
+    for (auto &entry : this->cell_matrix_cache)
+    {
+        /* A map node has three pointers and a color besides its value. */
+        cell_matrix_cache_bytes += 4*sizeof(void*) + sizeof(entry)
+            + entry.second.mass.memory_consumption()
+            + entry.second.convection_diffusion.memory_consumption();
+    }
+
+    std::size_t output_records_bytes = MemoryConsumption::memory_consumption(this->vtu_times_and_names);
+
+#ifdef DEAL_II_WITH_HDF5
+    /* XDMFEntry has no memory_consumption() method. */
+    output_records_bytes += this->xdmf_entries.capacity()*sizeof(XDMFEntry);
+#endif
+
+    const std::vector<std::pair<std::string, std::size_t>> items = {
+        {"triangulation", this->triangulation.memory_consumption()},
+        {"dof_handler", this->dof_handler.memory_consumption()},
+        {"constraints", this->constraints.memory_consumption()},
+        {"sparsity_pattern", this->sparsity_pattern.memory_consumption()},
+        {"mass_matrix", this->mass_matrix.memory_consumption()},
+        {"convection_diffusion_matrix", this->convection_diffusion_matrix.memory_consumption()},
+        {"system_matrix", this->system_matrix.memory_consumption()},
+        {"explicit_matrix", this->explicit_matrix.memory_consumption()},
+        {"sell_c_sigma_matrices", this->sell_explicit_matrix.memory_consumption()
+            + this->sell_system_matrix.memory_consumption()},
+        {"cell_matrix_cache", cell_matrix_cache_bytes},
+        {"solution_vectors", this->solution.memory_consumption()
+            + this->old_solution.memory_consumption() + this->system_rhs.memory_consumption()},
+        {"solver_workspace", GrowingVectorMemory<Vector<double>>().memory_consumption()},
+        {"verification_table", this->verification_table.memory_consumption()},
+        {"output_records", output_records_bytes}};
+
+    std::size_t total_bytes = 0;
+
+    const double megabyte = 1024.*1024.;
+
+    std::cout << std::endl << "Memory report after " << label << ":" << std::endl;
+
+    for (auto &item : items)
+    {
+        std::cout << "    " << std::left << std::setw(32) << item.first << std::right
+            << std::fixed << std::setprecision(3) << std::setw(12) << item.second/megabyte << " MB" << std::endl;
+
+        total_bytes += item.second;
+
+        Instrumentation::add("memory_" + item.first + "_bytes", double(item.second));
+    }
+
+    const double resident_bytes = Instrumentation::current_resident_bytes();
+
+    const double peak_resident_bytes = Instrumentation::peak_resident_bytes();
+
+    std::cout << "    " << std::left << std::setw(32) << "tracked_total" << std::right
+        << std::setw(12) << total_bytes/megabyte << " MB" << std::endl
+        << "    " << std::left << std::setw(32) << "resident_set_size" << std::right
+        << std::setw(12) << resident_bytes/megabyte << " MB" << std::endl
+        << "    " << std::left << std::setw(32) << "peak_resident_set_size" << std::right
+        << std::setw(12) << peak_resident_bytes/megabyte << " MB" << std::endl << std::endl;
+
+    std::cout.unsetf(std::ios_base::floatfield);
+
+    std::cout << std::setprecision(6);
+
+    Instrumentation::add("memory_tracked_total_bytes", double(total_bytes));
+
+    Instrumentation::add("resident_bytes", resident_bytes);
+
+    Instrumentation::add("peak_resident_bytes", peak_resident_bytes);
+}
@@ -8,6 +8,8 @@
 
 #include <deal.II/base/parameter_handler.h>
 
+#include "fe_field_tools.h"
+
 /*! Encapsulates parameter handling and paramter input file handling.
   
     Originally the ParameterReader from deal.II's step-26 was used;
@@ -62,6 +64,7 @@ namespace Peclet
         {
             std::string function_name;
             std::list<double> function_double_arguments; 
+            std::string old_field_file_path;
         };
         
         /*! Contains parameters for geometry */
@@ -87,6 +90,20 @@ namespace Peclet
             unsigned int cycles_at_interval;
             double refine_fraction;
             double coarsen_fraction;
+            std::string error_estimator;
+            bool cache_cell_matrices;
+        };
+        
+        /*! Contains parameters for grid refinement based only on the problem data
+            
+            Also see Peclet::Parameters::Refinement
+            
+        */
+        struct APrioriRefinement
+        {
+            unsigned int cycles;
+            double max_mesh_peclet;
+            double max_initial_gradient;
         };
         
         /*! Contains parameters for grid refinement */
@@ -95,6 +112,9 @@ namespace Peclet
             unsigned int initial_global_cycles;
             unsigned int initial_boundary_cycles;
             std::vector<unsigned int> boundaries_to_refine;
+            std::string boundary_refinement;
+            double boundary_layer_thickness;
+            APrioriRefinement a_priori;
             AdaptiveRefinement adaptive;
         };
         
@@ -108,6 +128,12 @@ namespace Peclet
             bool stop_when_steady;
         };
         
+        /*! Contains parameters for stabilizing convection-dominated problems */
+        struct Stabilization
+        {
+            std::string method;
+        };
+        
         /*! Contains parameters for the iterative solver */
         struct IterativeSolver
         {
@@ -115,14 +141,49 @@ namespace Peclet
             unsigned int max_iterations;
             double tolerance;
             bool normalize_tolerance;
+            std::string dof_renumbering;
+            std::string matrix_format;
         };
         
         /*! Contains parameters for solution output to file */
         struct Output
         {
             bool write_solution_vtk;
+            std::string format;
             bool write_solution_table;
             int time_step_interval;
+            std::string field_file_path;
+        };
+        
+        /*! Contains parameters for checkpointing the time loop, so that a run can be resumed */
+        struct Checkpoint
+        {
+            unsigned int interval;
+            std::string file_path;
+            bool write_on_sigterm;
+        };
+        
+        /*! Contains parameters for recording timers and counters, see Instrumentation */
+        struct Profiling
+        {
+            bool enabled;
+            std::string summary_file_path;
+            std::string summary_format;
+            std::string step_file_path;
+            std::string trace_file_path;
+            bool memory_report;
+        };
+        
+        /*! Contains parameters for caching the refined grid and assembled operators on disk 
+        
+            The key is not a parameter. It is a hash of every parameter subsection which the cached data depends on.
+            
+        */
+        struct SetupCache
+        {
+            bool enabled;
+            std::string directory;
+            std::string key;
         };
         
         /*! Contains parameters for verification against an exact solution */
@@ -141,9 +202,13 @@ namespace Peclet
             InitialValues initial_values;
             Geometry geometry;
             Refinement refinement;
+            Stabilization stabilization;
             Time time;
             IterativeSolver solver;
             Output output;
+            Checkpoint checkpoint;
+            Profiling profiling;
+            SetupCache setup_cache;
             Verification verification;
         };    
 
@@ -269,6 +334,13 @@ namespace Peclet
                     Patterns::List(Patterns::Double()),
                     "This is deprecated."); 
                     
+                prm.declare_entry("old_field_file_path", "",
+                    Patterns::Anything(),
+                    "The restart file from which to read the old field"
+                    " when function_name = interpolate_old_field."
+                    " If empty, then this is the default output.field_file_path,"
+                    " i.e. the restart file which a previous run of the same parameter file wrote.");
+                    
                 prm.enter_subsection("parsed_function");
                 {
                     Functions::ParsedFunction<dim>::declare_parameters(prm); 
@@ -322,6 +394,38 @@ namespace Peclet
                     Patterns::List(Patterns::Integer()),
                     "Refine cells that contain these boundaries");
                     
+                prm.declare_entry("boundary_refinement", "strip",
+                    Patterns::Selection("strip | graded"),
+                    "strip: Refine every cell which touches the boundaries, once per cycle."
+                    "\ngraded: Refine until the cell size normal to the boundaries is at most "
+                    "the boundary layer thickness plus the distance to the boundaries. "
+                    "Where possible, cells are only cut normal to the boundaries.");
+                    
+                prm.declare_entry("boundary_layer_thickness", "0.",
+                    Patterns::Double(),
+                    "Boundary layer thickness for graded boundary refinement. "
+                    "Set to zero to use the local estimate alpha/|v|.");
+                    
+                prm.enter_subsection ("a_priori");
+                {
+                    prm.declare_entry("cycles", "0",
+                        Patterns::Integer(0),
+                        "Before time stepping, refine cells which exceed the following thresholds "
+                        "up to this many times. Unlike adaptive initial_cycles, this does not "
+                        "require solving any time steps.");
+                        
+                    prm.declare_entry("max_mesh_peclet", "0.",
+                        Patterns::Double(0.),
+                        "Refine cells whose mesh Peclet number, |v|h/alpha, exceeds this. "
+                        "Set to zero to disable this criterion.");
+                        
+                    prm.declare_entry("max_initial_gradient", "0.",
+                        Patterns::Double(0.),
+                        "Refine cells where the variation of the initial values divided by the "
+                        "cell diameter exceeds this. Set to zero to disable this criterion.");
+                }
+                prm.leave_subsection();
+                
                 prm.enter_subsection ("adaptive");
                 {
                     prm.declare_entry("initial_cycles", "0",
@@ -340,8 +444,10 @@ namespace Peclet
                         
                     prm.declare_entry("max_cells", "2000",
                         Patterns::Integer(),
-                        "Skip grid refinement if the number of active cells "
-                        "already exceeds this");
+                        "Limit the number of active cells after each refinement to this. "
+                        "Once the limit is reached, cells with small estimated errors are "
+                        "coarsened to afford refining cells with large errors. "
+                        "Set to zero for no limit.");
                         
                     prm.declare_entry("refine_fraction", "0.3",
                         Patterns::Double(),
@@ -355,6 +461,19 @@ namespace Peclet
                         Patterns::Integer(),
                         "Max grid refinement level");
                         
+                    prm.declare_entry("error_estimator", "kelly",
+                        Patterns::Selection("kelly | residual"),
+                        "Error measure used to select cells for refinement."
+                        "\nkelly: Jumps of the solution gradient across faces"
+                        "\nresidual: Element residual of the convection-diffusion equation,"
+                        " weighted by the local mesh Peclet number, plus diffusive flux jumps");
+                        
+                    prm.declare_entry("cache_cell_matrices", "true",
+                        Patterns::Bool(),
+                        "If true, then keep the local mass and convection-diffusion matrices of every active cell,"
+                        " so that after refinement only the new cells are assembled."
+                        " This costs two dense matrices per cell, see profiling.memory_report.");
+                        
                 }
                 prm.leave_subsection();
                 
@@ -362,6 +481,17 @@ namespace Peclet
             prm.leave_subsection();
             
             
+            prm.enter_subsection ("stabilization");
+            {
+                prm.declare_entry("method", "none",
+                    Patterns::Selection("none | supg"),
+                    "none: Plain Galerkin, which oscillates for mesh Peclet numbers above one."
+                    "\nsupg: Streamline upwind Petrov-Galerkin, with the stabilization parameter "
+                    "tau = h/(2|v|)(coth(Pe) - 1/Pe) computed per cell."
+                    " This makes the system matrix nonsymmetric, so it requires solver.method = BiCGStab.");
+            }
+            prm.leave_subsection();
+            
             prm.enter_subsection ("time");
             {
                 prm.declare_entry("end_time", "1.",
@@ -398,7 +528,8 @@ namespace Peclet
             {
                 prm.declare_entry("method", "CG",
                      Patterns::Selection("CG | BiCGStab"),
-                     "Select an iterative method for solving the linear system.");
+                     "Select an iterative method for solving the linear system."
+                     " CG requires a symmetric matrix, so it cannot be used with stabilization.method = supg.");
                      
                 prm.declare_entry("max_iterations", "1000",
                     Patterns::Integer(0),
@@ -412,6 +543,22 @@ namespace Peclet
                     Patterns::Bool(),
                     "If true, then the residual will be multiplied by the L2-norm of the RHS"
                     " before comparing to the convergence tolerance.");
+                    
+                prm.declare_entry("dof_renumbering", "none",
+                    Patterns::Selection("none | downwind | cuthill_mckee | hilbert"),
+                    "Renumber the DoFs after every distribution, including after adaptive refinement."
+                    "\ndownwind orders the DoFs along the flow of the velocity function, which makes"
+                    " the SSOR preconditioner much more effective for convection-dominated problems."
+                    "\ncuthill_mckee reduces the bandwidth of the matrices, for cache locality."
+                    "\nhilbert orders the DoFs along a Hilbert curve through their support points,"
+                    " which keeps the accesses of the matrix-vector products local at every cache level.");
+                    
+                prm.declare_entry("matrix_format", "csr",
+                    Patterns::Selection("csr | sell_c_sigma"),
+                    "The storage of the matrices in the matrix-vector products of the time loop."
+                    "\ncsr uses the SparseMatrix directly."
+                    "\nsell_c_sigma uses vectorized, thread-parallel copies in the sliced ELLPACK format,"
+                    " at the cost of a second copy of the values and column indices.");
             }
             prm.leave_subsection();
             
@@ -420,16 +567,93 @@ namespace Peclet
                 prm.declare_entry("write_solution_vtk", "true", Patterns::Bool(),
                 "Write the solution to VTK files for visualization in Paraview or VisIt.");
                 
+                prm.declare_entry("format", "vtk", Patterns::Selection("vtk | vtu | hdf5"),
+                    "Select the file format used when write_solution_vtk is true."
+                    "\nvtk: Legacy ASCII VTK, one self-contained file per output step."
+                    "\nvtu: Compressed binary VTU, indexed by solution.pvd."
+                    "\nhdf5: HDF5 indexed by solution.xdmf."
+                    " The mesh is only written when it changes, and every other step"
+                    " only writes the solution. This requires deal.II with HDF5.");
+                
                 prm.declare_entry("write_solution_table", "false", Patterns::Bool(),
                     "This allow for simple export of 1D solutions into a table format"
                     " easily read by MATLAB."
-                    "\nThe way this is currently implemented takes a great deal of memory"
-                    ", so you should probably only use this in 1D.");
+                    "\nIn 1D the solution is always streamed to 1D_solution_history.bin"
+                    ", and if this is true then it is exported to 1D_solution_table.txt"
+                    " at the end of the run."
+                    "\nA history from an interrupted run can be exported with"
+                    "\n  peclet --export-1D-solution-table 1D_solution_history.bin 1D_solution_table.txt");
                     
                 prm.declare_entry("time_step_interval", "1", Patterns::Integer(0),
                     "Solutions will only be written at every time_step_interval time step."
                     "\nSet to one to output at every time step."
                     "\n Set to zero to output only the final time.");
+                    
+                prm.declare_entry("field_file_path", "", Patterns::Anything(),
+                    "Write the final solution and its mesh to this restart file,"
+                    " so that it can be used as initial values for another run."
+                    " If empty, then this is the parameter file name with the extension .restart,"
+                    " e.g. case.restart for case.prm, or peclet.restart without a parameter file.");
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("checkpoint");
+            {
+                prm.declare_entry("interval", "0", Patterns::Integer(0),
+                    "Write a checkpoint of the full time loop state at every interval time steps."
+                    " Run with --resume to continue from the last checkpoint."
+                    "\nSet to zero to never write periodic checkpoints.");
+                    
+                prm.declare_entry("file_path", "", Patterns::Anything(),
+                    "Write checkpoints to this file, and resume from it."
+                    " If empty, then this is the parameter file name with the extension .checkpoint,"
+                    " e.g. case.checkpoint for case.prm, or peclet.checkpoint without a parameter file.");
+                    
+                prm.declare_entry("write_on_sigterm", "true", Patterns::Bool(),
+                    "If true, then SIGTERM stops the run after the current time step"
+                    " and writes a checkpoint.");
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("profiling");
+            {
+                prm.declare_entry("enabled", "false", Patterns::Bool(),
+                    "If true, then record the wall and CPU time of every phase of the run,"
+                    " along with counters such as solver iterations, residuals, DoFs and bytes written.");
+                    
+                prm.declare_entry("summary_file_path", "profile.json", Patterns::Anything(),
+                    "Write the accumulated timers and counters to this file at the end of the run.");
+                    
+                prm.declare_entry("summary_format", "json", Patterns::Selection("json | csv"),
+                    "Format of the summary file");
+                    
+                prm.declare_entry("step_file_path", "", Patterns::Anything(),
+                    "If not empty, then append the times and counters of every time step"
+                    " to this file, as one JSON object per line.");
+                    
+                prm.declare_entry("trace_file_path", "", Patterns::Anything(),
+                    "If not empty, then record a timeline of the phases and parallel tasks of every thread,"
+                    " and write it to this file in the Chrome trace-event format, e.g. for Perfetto."
+                    " The environment variable PECLET_TRACE_FILE overrides this."
+                    " This is independent of the enabled parameter.");
+                    
+                prm.declare_entry("memory_report", "false", Patterns::Bool(),
+                    "If true, then print the memory used by each data structure, along with the current"
+                    " and peak resident set size of the process, after every setup of the system and at exit.");
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("setup_cache");
+            {
+                prm.declare_entry("enabled", "false", Patterns::Bool(),
+                    "If true, then the initially refined grid, sparsity pattern, mass matrix"
+                    " and convection-diffusion matrix are read from a cache file if one exists"
+                    " for identical geometry, refinement, velocity and diffusivity parameters."
+                    " Otherwise they are computed as usual and written to a new cache file.");
+                    
+                prm.declare_entry("directory", ".", Patterns::Anything(),
+                    "Read and write cache files in this directory."
+                    " It can be shared by concurrent runs.");
             }
             prm.leave_subsection();
             
@@ -470,6 +694,105 @@ namespace Peclet
             return items;
         }    
         
+        /*! Hash every parameter subsection which the initially refined grid and the assembled operators depend on 
+        
+            See Parameters::SetupCache.
+            
+        */
+        std::string setup_cache_key(ParameterHandler &prm)
+        {
+            /* Increment this whenever the cached data or the way it is computed changes. */
+            const unsigned int setup_cache_version = 1;
+            
+            std::ostringstream text;
+            
+            text << "version " << setup_cache_version << std::endl;
+            
+            std::vector<std::string> subsections = {"meta", "geometry", "refinement", "stabilization",
+                 "parsed_velocity_function", "parsed_diffusivity_function"};
+            
+            /* Only the a priori refinement makes the grid depend on the initial values.
+            If these are interpolated from an old field file, then the grid also depends on its contents. */
+            prm.enter_subsection("refinement");
+            prm.enter_subsection("a_priori");
+            const bool grid_depends_on_initial_values =
+                (prm.get_integer("cycles") > 0) && (prm.get_double("max_initial_gradient") > 0.);
+            prm.leave_subsection();
+            prm.leave_subsection();
+            
+            if (grid_depends_on_initial_values)
+            {
+                subsections.push_back("initial_values");
+                
+                prm.enter_subsection("initial_values");
+                if (prm.get("function_name") == "interpolate_old_field")
+                {
+                    const std::string old_field_file_path = prm.get("old_field_file_path");
+                    
+                    /* A missing file is reported when the initial values are interpolated. */
+                    if (std::ifstream(old_field_file_path).good())
+                    {
+                        FEFieldTools::MappedFile old_field_file(old_field_file_path);
+                        
+                        text << "old_field_checksum " << std::hex
+                            << FEFieldTools::checksum(old_field_file.data, old_field_file.size)
+                            << std::dec << std::endl;
+                    }
+                }
+                prm.leave_subsection();
+            }
+            
+            for (auto subsection : subsections)
+            {
+                prm.enter_subsection(subsection);
+                {
+                    text << subsection << std::endl;
+                    prm.print_parameters_section(text, ParameterHandler::Text, 0);
+                }
+                prm.leave_subsection();
+            }
+            
+            /* The cached operators are in the renumbered DoF order. */
+            prm.enter_subsection("solver");
+            {
+                text << "dof_renumbering " << prm.get("dof_renumbering") << std::endl;
+            }
+            prm.leave_subsection();
+            
+            const std::string text_string = text.str();
+            
+            std::ostringstream key;
+            
+            key << std::hex << FEFieldTools::checksum(text_string.data(), text_string.size());
+            
+            return key.str();
+        }
+        
+        /*! The parameter file name without its directory and extension, or "peclet" without a parameter file
+        
+            This names the default restart and checkpoint files, so that runs of different parameter files
+            in the same directory do not overwrite each other's files.
+            
+        */
+        std::string run_name(const std::string parameter_file)
+        {
+            std::string name = parameter_file.substr(parameter_file.find_last_of('/') + 1);
+            
+            name = name.substr(0, name.find_last_of('.'));
+            
+            return name.empty() ? "peclet" : name;
+        }
+        
+        /*! Set a file path parameter of the current subsection to the default, if it is empty */
+        void set_default_file_path(ParameterHandler &prm, const std::string parameter_name,
+            const std::string default_file_path)
+        {
+            if (prm.get(parameter_name) == "")
+            {
+                prm.set(parameter_name, default_file_path);
+            }
+        }
+        
         /*! Read only the parameters needed for instantiating a Peclet::Peclet */
         Meta read_meta_parameters(const std::string parameter_file="")
         {
@@ -518,6 +841,27 @@ namespace Peclet
                 prm.read_input(parameter_file);    
             }
             
+            /* Resolve the default file paths, so that they are also logged */
+            const std::string field_file_path = run_name(parameter_file) + ".restart";
+            
+            prm.enter_subsection("output");
+            {
+                set_default_file_path(prm, "field_file_path", field_file_path);
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("initial_values");
+            {
+                set_default_file_path(prm, "old_field_file_path", field_file_path);
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("checkpoint");
+            {
+                set_default_file_path(prm, "file_path", run_name(parameter_file) + ".checkpoint");
+            }
+            prm.leave_subsection();
+            
             // Print a log file of all the ParameterHandler parameters
             std::ofstream parameter_log_file("used_parameters.prm");
             assert(parameter_log_file.good());
@@ -596,6 +940,7 @@ namespace Peclet
             prm.enter_subsection("initial_values");
             {               
                 params.initial_values.function_name = prm.get("function_name"); 
+                params.initial_values.old_field_file_path = prm.get("old_field_file_path");
                 
                 prm.enter_subsection("parsed_function");
                 {
@@ -614,6 +959,16 @@ namespace Peclet
                 params.refinement.initial_boundary_cycles = prm.get_integer("initial_boundary_cycles");
                 params.refinement.boundaries_to_refine = 
                     Parameters::get_vector<unsigned int>(prm, "boundaries_to_refine");
+                params.refinement.boundary_refinement = prm.get("boundary_refinement");
+                params.refinement.boundary_layer_thickness = prm.get_double("boundary_layer_thickness");
+                
+                prm.enter_subsection("a_priori");
+                {
+                    params.refinement.a_priori.cycles = prm.get_integer("cycles");
+                    params.refinement.a_priori.max_mesh_peclet = prm.get_double("max_mesh_peclet");
+                    params.refinement.a_priori.max_initial_gradient = prm.get_double("max_initial_gradient");
+                }
+                prm.leave_subsection();
                 
                 prm.enter_subsection("adaptive");
                 {
@@ -624,6 +979,8 @@ namespace Peclet
                     params.refinement.adaptive.cycles_at_interval = prm.get_integer("cycles_at_interval");
                     params.refinement.adaptive.refine_fraction = prm.get_double("refine_fraction");
                     params.refinement.adaptive.coarsen_fraction = prm.get_double("coarsen_fraction");    
+                    params.refinement.adaptive.error_estimator = prm.get("error_estimator");
+                    params.refinement.adaptive.cache_cell_matrices = prm.get_bool("cache_cell_matrices");
                 }        
                 
                 prm.leave_subsection();
@@ -631,6 +988,11 @@ namespace Peclet
             }
             prm.leave_subsection();
                 
+            prm.enter_subsection("stabilization");
+            {
+                params.stabilization.method = prm.get("method");
+            }
+            prm.leave_subsection();
                 
             prm.enter_subsection("time");
             {
@@ -650,14 +1012,51 @@ namespace Peclet
                 params.solver.max_iterations = prm.get_integer("max_iterations");
                 params.solver.tolerance = prm.get_double("tolerance");
                 params.solver.normalize_tolerance = prm.get_bool("normalize_tolerance");
+                params.solver.dof_renumbering = prm.get("dof_renumbering");
+                params.solver.matrix_format = prm.get("matrix_format");
             }    
             prm.leave_subsection(); 
             
+            /* The SUPG terms tau(v.grad phi_i, phi_j) and tau(v.grad phi_i, v.grad phi_j) are not symmetric. */
+            AssertThrow((params.stabilization.method != "supg") || (params.solver.method != "CG"),
+                ExcMessage("stabilization.method = supg makes the system matrix nonsymmetric,"
+                    " so it requires solver.method = BiCGStab instead of CG."));
+            
             prm.enter_subsection("output");
             {
                 params.output.write_solution_vtk = prm.get_bool("write_solution_vtk");
+                params.output.format = prm.get("format");
                 params.output.write_solution_table = prm.get_bool("write_solution_table");
                 params.output.time_step_interval = prm.get_integer("time_step_interval");
+                params.output.field_file_path = prm.get("field_file_path");
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("setup_cache");
+            {
+                params.setup_cache.enabled = prm.get_bool("enabled");
+                params.setup_cache.directory = prm.get("directory");
+            }
+            prm.leave_subsection();
+            
+            params.setup_cache.key = setup_cache_key(prm);
+            
+            prm.enter_subsection("checkpoint");
+            {
+                params.checkpoint.interval = prm.get_integer("interval");
+                params.checkpoint.file_path = prm.get("file_path");
+                params.checkpoint.write_on_sigterm = prm.get_bool("write_on_sigterm");
+            }
+            prm.leave_subsection();
+            
+            prm.enter_subsection("profiling");
+            {
+                params.profiling.enabled = prm.get_bool("enabled");
+                params.profiling.summary_file_path = prm.get("summary_file_path");
+                params.profiling.summary_format = prm.get("summary_format");
+                params.profiling.step_file_path = prm.get("step_file_path");
+                params.profiling.trace_file_path = prm.get("trace_file_path");
+                params.profiling.memory_report = prm.get_bool("memory_report");
             }
             prm.leave_subsection();
             
@@ -0,0 +1,135 @@
+/*
+An opt-in on-disk cache of the initially refined grid and the assembled operators.
+
+The cache file name contains a hash of every parameter which the grid and operators depend on,
+and of the old field file if the initial grid is refined by its gradient, see Parameters::setup_cache_key,
+so a cached setup is only ever loaded for identical inputs. A corrupt cache file is discarded and rebuilt.
+Only the setup before time stepping is cached, since adaptive refinement depends on the solution.
+
+The triangulation is stored with deal.II's own serialization, so that distribute_dofs reproduces
+the DoF numbering for which the cached sparsity pattern and matrices were assembled.
+*/
+
+const char SETUP_CACHE_MAGIC[8] = {'P', 'E', 'C', 'L', 'E', 'T', 'S', 'C'};
+
+template<int dim>
+std::string Peclet<dim>::setup_cache_file_path() const
+{
+    return this->params.setup_cache.directory + "/peclet-" + std::to_string(dim) + "d-"
+        + this->params.setup_cache.key + ".cache";
+}
+
+template<int dim>
+void Peclet<dim>::write_setup_cache()
+{
+    FEFieldTools::Writer payload;
+    
+    {
+        std::ostringstream archive_stream;
+        
+        {
+            boost::archive::binary_oarchive archive(archive_stream);
+            
+            archive << this->triangulation;
+        }
+        
+        payload.write(archive_stream.str());
+    }
+    
+    {
+        std::ostringstream block_stream;
+        
+        this->sparsity_pattern.block_write(block_stream);
+        
+        payload.write(block_stream.str());
+    }
+    
+    for (SparseMatrix<double> *matrix : {&this->mass_matrix, &this->convection_diffusion_matrix})
+    {
+        std::ostringstream block_stream;
+        
+        matrix->block_write(block_stream);
+        
+        payload.write(block_stream.str());
+    }
+    
+    FEFieldTools::Header header;
+    
+    header.dim = dim;
+    
+    header.solution_offset = 0;
+    
+    header.n_dofs = this->dof_handler.n_dofs();
+    
+    FEFieldTools::write_file(this->setup_cache_file_path(), header, payload, SETUP_CACHE_MAGIC);
+}
+
+template<int dim>
+bool Peclet<dim>::read_setup_cache()
+{
+    const std::string file_path = this->setup_cache_file_path();
+    
+    if (!std::ifstream(file_path).good())
+    {
+        return false;
+    }
+    
+    std::unique_ptr<FEFieldTools::MappedFile> file;
+    
+    FEFieldTools::Header header;
+    
+    /* The checksum covers the whole payload, so a corrupt or truncated cache file is detected here,
+    before anything is read from it. It is then discarded, and rebuilt by the caller. */
+    try
+    {
+        file.reset(new FEFieldTools::MappedFile(file_path));
+        
+        header = FEFieldTools::read_header(*file, file_path, dim, SETUP_CACHE_MAGIC);
+    }
+    catch (const std::exception &exception)
+    {
+        std::cerr << "Discarding the setup cache: " << exception.what() << std::endl;
+        
+        file.reset();
+        
+        std::remove(file_path.c_str());
+        
+        return false;
+    }
+    
+    FEFieldTools::Reader reader(file->data + sizeof(FEFieldTools::Header), header.payload_size);
+    
+    {
+        std::istringstream archive_stream(reader.read_string());
+        
+        boost::archive::binary_iarchive archive(archive_stream);
+        
+        archive >> this->triangulation;
+    }
+    
+    this->setup_system(false, /* assemble = */ false);
+    
+    if (this->dof_handler.n_dofs() != header.n_dofs)
+    {
+        throw std::runtime_error("The setup cache " + file_path + " is inconsistent");
+    }
+    
+    {
+        std::istringstream block_stream(reader.read_string());
+        
+        this->sparsity_pattern.block_read(block_stream);
+    }
+    
+    for (SparseMatrix<double> *matrix : {&this->mass_matrix, &this->convection_diffusion_matrix})
+    {
+        std::istringstream block_stream(reader.read_string());
+        
+        matrix->reinit(this->sparsity_pattern);
+        
+        matrix->block_read(block_stream);
+    }
+    
+    this->system_matrix.reinit(this->sparsity_pattern);
+    
+    return true;
+}
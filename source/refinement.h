@@ -1,6 +1,178 @@
 namespace Refinement
 {
 
+    /*! Count the active cells which the triangulation will have after executing the present flags.
+    
+        This calls prepare_coarsening_and_refinement, which makes the flags consistent,
+        e.g. by dropping coarsening flags of cells whose siblings are not all flagged.
+        Anisotropic refinement, e.g. of the graded boundary layers, creates fewer children than isotropic refinement,
+        so every refinement and coarsening is counted by its actual number of children.
+        
+    */
+    template <int dim>
+    unsigned int count_cells_after_refinement(Triangulation<dim> &triangulation)
+    {
+        triangulation.prepare_coarsening_and_refinement();
+        unsigned int new_cells = 0, removed_cells = 0;
+        for (auto cell : triangulation.active_cell_iterators())
+        {
+            if (cell->refine_flag_set())
+            {
+                new_cells += GeometryInfo<dim>::n_children(cell->refine_flag_set()) - 1;
+            }
+            else if (cell->coarsen_flag_set() && (cell->level() > 0) && (cell->parent()->child(0)->index() == cell->index()))
+            { /* Count each coarsened parent once, at its first child. All of its children are flagged. */
+                removed_cells += cell->parent()->n_children() - 1;
+            }
+        }
+        return triangulation.n_active_cells() + new_cells - removed_cells;
+    }
+    
+    /*! Adjust the refinement and coarsening flags such that the grid will have at most max_cells active cells.
+    
+        Rather than cancelling all refinement once the budget is reached, which would freeze the grid
+        while coarsening continues, the cells are traded: the sibling group with the smallest estimated error among
+        the remaining coarsening candidates is coarsened, unless the refined cell with the smallest error
+        has an even smaller error, in which case that refinement is cancelled instead.
+        This is done in batches sized by the surplus, until the projected number of cells fits the budget.
+        
+        A cell can only be coarsened together with all of its siblings, since prepare_coarsening_and_refinement
+        drops the coarsening flags of incomplete sibling groups. So the coarsening candidates are the parents
+        whose children are all active and not flagged for refinement, ranked by the largest error of their children,
+        and all of their children are flagged at once.
+        
+    */
+    template <int dim>
+    void enforce_cell_budget(
+        Triangulation<dim> &triangulation,
+        const Vector<float> &estimated_error_per_cell,
+        const unsigned int min_grid_level,
+        const unsigned int max_cells)
+    {
+        unsigned int projected_cell_count = count_cells_after_refinement(triangulation);
+        if (projected_cell_count <= max_cells)
+        {
+            return;
+        }
+        
+        typedef typename Triangulation<dim>::cell_iterator CellIterator;
+        std::vector<std::pair<float, CellIterator>> coarsen_candidates, refined_cells;
+        for (auto cell : triangulation.active_cell_iterators())
+        {
+            if (cell->refine_flag_set())
+            {
+                refined_cells.push_back(std::make_pair(
+                    estimated_error_per_cell(cell->active_cell_index()), cell));
+            }
+            else if ((cell->level() > (int)min_grid_level) && (cell->parent()->child(0)->index() == cell->index()))
+            { /* Consider each parent once, at its first child. */
+                const CellIterator parent = cell->parent();
+                bool coarsenable = true, all_flagged = true;
+                float max_error = 0.;
+                for (unsigned int c = 0; c < parent->n_children(); ++c)
+                {
+                    const CellIterator child = parent->child(c);
+                    if (!child->active() || child->refine_flag_set())
+                    {
+                        coarsenable = false;
+                        break;
+                    }
+                    all_flagged = all_flagged && child->coarsen_flag_set();
+                    max_error = std::max(max_error, estimated_error_per_cell(child->active_cell_index()));
+                }
+                if (coarsenable && !all_flagged)
+                {
+                    coarsen_candidates.push_back(std::make_pair(max_error, parent));
+                }
+            }
+        }
+        auto by_error = [](const std::pair<float, CellIterator> &a,
+                           const std::pair<float, CellIterator> &b)
+        {
+            return a.first < b.first;
+        };
+        std::sort(coarsen_candidates.begin(), coarsen_candidates.end(), by_error);
+        std::sort(refined_cells.begin(), refined_cells.end(), by_error);
+        
+        const unsigned int new_cells_per_refinement = GeometryInfo<dim>::max_children_per_cell - 1;
+        unsigned int next_coarsen = 0, next_unrefine = 0;
+        while (projected_cell_count > max_cells)
+        {
+            const bool can_coarsen = next_coarsen < coarsen_candidates.size(),
+                can_unrefine = next_unrefine < refined_cells.size();
+            if (!can_coarsen && !can_unrefine)
+            {
+                break;
+            }
+            const unsigned int surplus = projected_cell_count - max_cells;
+            if (can_coarsen && (!can_unrefine ||
+                (coarsen_candidates[next_coarsen].first < refined_cells[next_unrefine].first)))
+            {
+                const unsigned int end = std::min(
+                    next_coarsen + (surplus + new_cells_per_refinement - 1)/new_cells_per_refinement,
+                    (unsigned int)coarsen_candidates.size());
+                for (; next_coarsen < end; ++next_coarsen)
+                {
+                    const CellIterator parent = coarsen_candidates[next_coarsen].second;
+                    for (unsigned int c = 0; c < parent->n_children(); ++c)
+                    {
+                        parent->child(c)->set_coarsen_flag();
+                    }
+                }
+            }
+            else
+            {
+                const unsigned int end = std::min(
+                    next_unrefine + (surplus + new_cells_per_refinement - 1)/new_cells_per_refinement,
+                    (unsigned int)refined_cells.size());
+                for (; next_unrefine < end; ++next_unrefine)
+                {
+                    refined_cells[next_unrefine].second->clear_refine_flag();
+                }
+            }
+            projected_cell_count = count_cells_after_refinement(triangulation);
+        }
+    }
+
+    /*! Flag cells for refinement and coarsening based on an error measure, within the grid level and cell limits. */
+    template <int dim>
+    void flag_cells_for_refinement(
+        Triangulation<dim> &triangulation,
+        const Vector<float> &estimated_error_per_cell,
+        const unsigned int min_grid_level,
+        const unsigned int max_grid_level,
+        const unsigned int max_cells,
+        const double refine_fraction,
+        const double coarsen_fraction)
+    {
+        GridRefinement::refine_and_coarsen_fixed_fraction(
+            triangulation,
+            estimated_error_per_cell,
+            refine_fraction,
+            coarsen_fraction);
+        if (triangulation.n_levels() > max_grid_level)
+        {
+            for (auto cell = triangulation.begin_active(max_grid_level);
+                 cell != triangulation.end(); ++cell)
+            {
+                cell->clear_refine_flag ();    
+            }
+        }
+        for (auto cell = triangulation.begin_active(min_grid_level);
+             cell != triangulation.end_active(min_grid_level); ++cell)
+        {
+            cell->clear_coarsen_flag ();     
+        }
+        if (max_cells > 0)
+        {
+            enforce_cell_budget(
+                triangulation,
+                estimated_error_per_cell,
+                min_grid_level,
+                max_cells);
+        }
+    }
+    
     /*! Adaptively refine the triangulation based on an error measure.
             
         This is mostly a copy of the routine from deal.II's step-26, which uses the Kelly Error Estimator.
@@ -26,34 +198,82 @@ namespace Refinement
             typename FunctionMap<dim>::type(),
             solution,
             estimated_error_per_cell);
-        GridRefinement::refine_and_coarsen_fixed_fraction(
+        flag_cells_for_refinement(
             triangulation,
             estimated_error_per_cell,
+            min_grid_level,
+            max_grid_level,
+            max_cells,
             refine_fraction,
             coarsen_fraction);
-        if (triangulation.n_levels() > max_grid_level)
+        triangulation.prepare_coarsening_and_refinement();
+        solution_trans.prepare_for_coarsening_and_refinement(solution);
+        triangulation.execute_coarsening_and_refinement();
+    }
+    
+    /*! Refine cells which can not resolve the solution, based only on the problem data.
+    
+        This runs before time stepping, so that no time steps are solved on a grid which is known to be too coarse.
+        
+        A cell is flagged if its mesh Peclet number, |v|h/alpha at the cell center, exceeds max_mesh_peclet,
+        or if the variation of the initial values over its vertices and center, divided by its diameter h,
+        exceeds max_initial_gradient. Set either threshold to zero to disable that criterion.
+        
+        All flagged cells are refined in one batch per cycle, and the cycles stop early once no cell is flagged.
+        
+    */
+    template <int dim>
+    void refine_mesh_a_priori(
+        Triangulation<dim> &triangulation,
+        const Function<dim> &velocity,
+        const Function<dim> &diffusivity,
+        const Function<dim> *const initial_values,
+        const unsigned int refinement_cycles,
+        const double max_mesh_peclet,
+        const double max_initial_gradient,
+        const unsigned int max_grid_level)
+    {
+        Vector<double> velocity_value(dim);
+        for (unsigned int i = 0; i < refinement_cycles; i++)
         {
-            for (auto cell = triangulation.begin_active(max_grid_level);
-                 cell != triangulation.end(); ++cell)
+            bool flagged_any = false;
+            for (auto cell : triangulation.active_cell_iterators())
             {
-                cell->clear_refine_flag ();    
+                if (cell->level() >= (int)max_grid_level)
+                {
+                    continue;
+                }
+                const Point<dim> center = cell->center();
+                const double h = cell->diameter();
+                bool flagged = false;
+                if (max_mesh_peclet > 0.)
+                {
+                    velocity.vector_value(center, velocity_value);
+                    flagged = (velocity_value.l2_norm()*h > max_mesh_peclet*diffusivity.value(center));
+                }
+                if (!flagged && (max_initial_gradient > 0.) && (initial_values != NULL))
+                {
+                    double min_value = initial_values->value(center), max_value = min_value;
+                    for (unsigned int v = 0; v < GeometryInfo<dim>::vertices_per_cell; ++v)
+                    {
+                        const double value = initial_values->value(cell->vertex(v));
+                        min_value = std::min(min_value, value);
+                        max_value = std::max(max_value, value);
+                    }
+                    flagged = (max_value - min_value > max_initial_gradient*h);
+                }
+                if (flagged)
+                {
+                    cell->set_refine_flag();
+                    flagged_any = true;
+                }
             }
-        }
-        for (auto cell = triangulation.begin_active(min_grid_level);
-             cell != triangulation.end_active(min_grid_level); ++cell)
-        {
-            cell->clear_coarsen_flag ();     
-        }
-        if ((max_cells > 0) & (triangulation.n_active_cells() > max_cells))
-        {
-           for (auto cell = triangulation.begin_active(); cell != triangulation.end(); ++cell)
+            if (!flagged_any)
             {
-                cell->clear_refine_flag ();
+                break;
             }
+            triangulation.execute_coarsening_and_refinement();
         }
-        triangulation.prepare_coarsening_and_refinement();
-        solution_trans.prepare_for_coarsening_and_refinement(solution);
-        triangulation.execute_coarsening_and_refinement();
     }
     
     /*! Refine the mesh only near specified boundaries. */
@@ -97,4 +317,128 @@ namespace Refinement
         }
     }   
     
+    /*! Refine the mesh near specified boundaries, grading the cell size with the distance to the boundaries.
+    
+        Refining every cell which touches a boundary only doubles the resolution of a one cell thick strip per cycle.
+        Here, the cells are instead refined until their size normal to the boundary is at most
+        the boundary layer thickness plus their distance to the boundary. This resolves a layer of the given
+        thickness at the wall, and lets the cells grow proportionally to the distance away from it.
+        
+        If layer_thickness is not positive, then the local layer thickness alpha/|v| is used.
+        
+        Quadrilateral and hexahedral cells with an edge direction close to the boundary normal are only
+        cut along that direction, so the cells do not become smaller tangentially to the boundary.
+        
+        The distance to the boundaries is approximated by the distance to the nearest boundary vertex or face center.
+        
+    */
+    template <int dim>
+    void refine_mesh_near_boundaries_graded (
+        Triangulation<dim> &triangulation,
+        const std::vector<unsigned int> boundary_ids,
+        const unsigned int refinement_cycles,
+        const double layer_thickness,
+        const Function<dim> &velocity,
+        const Function<dim> &diffusivity,
+        const unsigned int max_grid_level)
+    {
+        /* Edges which deviate by more than this from the boundary normal are not considered normal. */
+        const double min_alignment = 0.9;
+        Vector<double> velocity_value(dim);
+        for (unsigned int i = 0; i < refinement_cycles; i++)
+        {
+            std::vector<Point<dim>> boundary_points;
+            for (auto cell : triangulation.active_cell_iterators())
+            {
+                if (!(cell->at_boundary()))
+                {
+                    continue;
+                }
+                for (unsigned int f=0; f<GeometryInfo<dim>::faces_per_cell; ++f)
+                {
+                    if (!cell->face(f)->at_boundary() ||
+                        (std::find(boundary_ids.begin(), boundary_ids.end(), cell->face(f)->boundary_id())
+                         == boundary_ids.end()))
+                    {
+                        continue;
+                    }
+                    boundary_points.push_back(cell->face(f)->center());
+                    for (unsigned int v=0; v<GeometryInfo<dim>::vertices_per_face; ++v)
+                    {
+                        boundary_points.push_back(cell->face(f)->vertex(v));
+                    }
+                }
+            }
+            if (boundary_points.size() == 0)
+            {
+                return;
+            }
+            const SpatialIndex::KDTree<dim> boundary_tree(boundary_points);
+            bool flagged_any = false;
+            for (auto cell : triangulation.active_cell_iterators())
+            {
+                if (cell->level() >= (int)max_grid_level)
+                {
+                    continue;
+                }
+                const Point<dim> center = cell->center();
+                double thickness = layer_thickness;
+                if (thickness <= 0.)
+                {
+                    velocity.vector_value(center, velocity_value);
+                    const double speed = velocity_value.l2_norm();
+                    if (speed == 0.)
+                    { /* There is no convective boundary layer. */
+                        continue;
+                    }
+                    thickness = diffusivity.value(center)/speed;
+                }
+                double distance = std::numeric_limits<double>::max();
+                for (unsigned int v=0; v<GeometryInfo<dim>::vertices_per_cell; ++v)
+                {
+                    const Point<dim> &vertex = cell->vertex(v);
+                    distance = std::min(distance,
+                        vertex.distance(boundary_points[boundary_tree.nearest(vertex)]));
+                }
+                /* Find the cell axis which is aligned with the boundary normal, if any. */
+                const Tensor<1,dim> normal = boundary_points[boundary_tree.nearest(center)] - center;
+                unsigned int normal_axis = dim;
+                double normal_size = cell->diameter();
+                for (unsigned int axis = 0; (dim > 1) && (axis < dim) && (normal.norm() > 0.); ++axis)
+                {
+                    Tensor<1,dim> edge;
+                    for (unsigned int v=0; v<GeometryInfo<dim>::vertices_per_cell; ++v)
+                    {
+                        const double sign = ((v >> axis) & 1) ? 1. : -1.;
+                        edge += sign*cell->vertex(v)/(GeometryInfo<dim>::vertices_per_cell/2);
+                    }
+                    if (std::abs(edge*normal) > min_alignment*edge.norm()*normal.norm())
+                    {
+                        normal_axis = axis;
+                        normal_size = edge.norm();
+                        break;
+                    }
+                }
+                if (normal_size <= thickness + distance)
+                {
+                    continue;
+                }
+                if (normal_axis < dim)
+                {
+                    cell->set_refine_flag(RefinementCase<dim>::cut_axis(normal_axis));
+                }
+                else
+                {
+                    cell->set_refine_flag();
+                }
+                flagged_any = true;
+            }
+            if (!flagged_any)
+            {
+                break;
+            }
+            triangulation.execute_coarsening_and_refinement();
+        }
+    }
+    
 }
\ No newline at end of file
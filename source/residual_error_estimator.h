@@ -0,0 +1,322 @@
+#ifndef _residual_error_estimator_h_
+#define _residual_error_estimator_h_
+
+#include <deal.II/base/function.h>
+#include <deal.II/base/quadrature.h>
+#include <deal.II/base/work_stream.h>
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/dofs/dof_accessor.h>
+#include <deal.II/fe/fe.h>
+#include <deal.II/fe/fe_values.h>
+#include <deal.II/lac/vector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "cell_chunks.h"
+
+/**
+ * @brief A residual-based a posteriori error estimator for the unsteady convection-diffusion equation.
+ *
+ * @detail
+ *
+ *    The KellyErrorEstimator only measures jumps of the solution gradient across faces.
+ *    It knows nothing about the velocity or the time derivative, so in convection-dominated problems
+ *    it refines smooth regions as much as boundary and interior layers.
+ *
+ *    Here the estimate for cell K is
+ *
+ *        eta_K^2 = w_K ||R||_K^2 + 1/2 sum_{F in K} w_K/h_K ||[alpha grad u . n]||_F^2
+ *
+ *    with the element residual of the theta-scheme
+ *
+ *        R = (u - u_old)/Delta_t + v . grad u - alpha lap u - s,
+ *
+ *    where the gradient of the diffusivity is neglected, and the weight
+ *
+ *        w_K = min(h_K^2/alpha_K, 2 h_K/|v|_K) = h_K^2/alpha_K min(1, 1/Pe_K)
+ *
+ *    with the mesh Peclet number Pe_K = |v|_K h_K/(2 alpha_K).
+ *    In diffusion-dominated cells this is the classical estimator for the Laplace operator,
+ *    while in convection-dominated cells the residual is measured on the streamline scale.
+ *
+ *    Boundary faces are not included. Each interior face is visited from both of its cells,
+ *    so that every cell can be processed independently, in parallel via WorkStream.
+*/
+namespace ResidualErrorEstimator
+{
+    using namespace dealii;
+
+    /*! The functions and fields which enter the residual */
+    template<int dim>
+    struct Problem
+    {
+        const Vector<double> *solution;
+        const Vector<double> *old_solution;
+        double time_step_size;
+        const Function<dim> *velocity;
+        const Function<dim> *diffusivity;
+        const Function<dim> *source;
+    };
+
+    template<int dim>
+    struct Scratch
+    {
+        Scratch(const FiniteElement<dim> &fe,
+                const Quadrature<dim> &quadrature,
+                const Quadrature<dim-1> &face_quadrature)
+            :
+            fe(fe),
+            quadrature(quadrature),
+            face_quadrature(face_quadrature),
+            fe_values(fe, quadrature,
+                update_values | update_gradients | update_hessians |
+                update_quadrature_points | update_JxW_values),
+            fe_face_values(fe, face_quadrature,
+                update_gradients | update_quadrature_points | update_normal_vectors | update_JxW_values),
+            neighbor_fe_face_values(fe, face_quadrature, update_gradients),
+            values(quadrature.size()),
+            old_values(quadrature.size()),
+            gradients(quadrature.size()),
+            laplacians(quadrature.size()),
+            diffusivities(quadrature.size()),
+            sources(quadrature.size()),
+            velocities(quadrature.size(), Vector<double>(dim)),
+            face_gradients(face_quadrature.size()),
+            neighbor_face_gradients(face_quadrature.size()),
+            face_diffusivities(face_quadrature.size())
+        {
+            /* There are no hanging nodes, and hence no subfaces, in 1D. */
+            if (dim > 1)
+            {
+                fe_subface_values.reset(new FESubfaceValues<dim>(fe, face_quadrature,
+                    update_gradients | update_quadrature_points | update_normal_vectors | update_JxW_values));
+                neighbor_fe_subface_values.reset(new FESubfaceValues<dim>(fe, face_quadrature,
+                    update_gradients));
+            }
+        }
+
+        Scratch(const Scratch &scratch)
+            :
+            Scratch(scratch.fe, scratch.quadrature, scratch.face_quadrature)
+        {}
+
+        const FiniteElement<dim> &fe;
+        const Quadrature<dim> &quadrature;
+        const Quadrature<dim-1> &face_quadrature;
+
+        FEValues<dim> fe_values;
+        FEFaceValues<dim> fe_face_values;
+        FEFaceValues<dim> neighbor_fe_face_values;
+        std::unique_ptr<FESubfaceValues<dim>> fe_subface_values;
+        std::unique_ptr<FESubfaceValues<dim>> neighbor_fe_subface_values;
+
+        std::vector<double> values;
+        std::vector<double> old_values;
+        std::vector<Tensor<1,dim>> gradients;
+        std::vector<double> laplacians;
+        std::vector<double> diffusivities;
+        std::vector<double> sources;
+        std::vector<Vector<double>> velocities;
+        std::vector<Tensor<1,dim>> face_gradients;
+        std::vector<Tensor<1,dim>> neighbor_face_gradients;
+        std::vector<double> face_diffusivities;
+    };
+
+    struct CopyData
+    {
+        unsigned int active_cell_index;
+        double estimated_error;
+    };
+
+    /*! Integrate the squared diffusive flux jump over one face, or subface, of the present cell.
+
+        fe_face_values must be reinitialized on the present cell,
+        and neighbor_fe_face_values on the same face seen from the neighbor.
+
+    */
+    template<int dim>
+    double integrate_squared_flux_jump(
+        const FEFaceValuesBase<dim> &fe_face_values,
+        const FEFaceValuesBase<dim> &neighbor_fe_face_values,
+        const Problem<dim> &problem,
+        Scratch<dim> &scratch)
+    {
+        const unsigned int n_q_points = fe_face_values.n_quadrature_points;
+        scratch.face_gradients.resize(n_q_points);
+        scratch.neighbor_face_gradients.resize(n_q_points);
+        scratch.face_diffusivities.resize(n_q_points);
+        fe_face_values.get_function_gradients(*problem.solution, scratch.face_gradients);
+        neighbor_fe_face_values.get_function_gradients(*problem.solution, scratch.neighbor_face_gradients);
+        problem.diffusivity->value_list(fe_face_values.get_quadrature_points(), scratch.face_diffusivities);
+        double integral = 0.;
+        for (unsigned int q = 0; q < n_q_points; ++q)
+        {
+            const double jump = scratch.face_diffusivities[q]*
+                ((scratch.face_gradients[q] - scratch.neighbor_face_gradients[q])*fe_face_values.normal_vector(q));
+            integral += jump*jump*fe_face_values.JxW(q);
+        }
+        return integral;
+    }
+
+    template<int dim>
+    void estimate_on_cell(
+        const typename DoFHandler<dim>::active_cell_iterator &cell,
+        const Problem<dim> &problem,
+        Scratch<dim> &scratch,
+        CopyData &copy_data)
+    {
+        FEValues<dim> &fe_values = scratch.fe_values;
+        fe_values.reinit(cell);
+        const unsigned int n_q_points = fe_values.n_quadrature_points;
+        const std::vector<Point<dim>> &points = fe_values.get_quadrature_points();
+
+        fe_values.get_function_values(*problem.solution, scratch.values);
+        fe_values.get_function_gradients(*problem.solution, scratch.gradients);
+        fe_values.get_function_laplacians(*problem.solution, scratch.laplacians);
+        problem.diffusivity->value_list(points, scratch.diffusivities);
+        problem.source->value_list(points, scratch.sources);
+        problem.velocity->vector_value_list(points, scratch.velocities);
+
+        const bool include_time_derivative = (problem.time_step_size > 0.)
+            && (problem.old_solution->size() == problem.solution->size());
+        if (include_time_derivative)
+        {
+            fe_values.get_function_values(*problem.old_solution, scratch.old_values);
+        }
+
+        /* Weight the residual by the local mesh Peclet number. */
+        const double h = cell->diameter();
+        double mean_diffusivity = 0., max_speed = 0.;
+        for (unsigned int q = 0; q < n_q_points; ++q)
+        {
+            mean_diffusivity += scratch.diffusivities[q]/n_q_points;
+            max_speed = std::max(max_speed, scratch.velocities[q].l2_norm());
+        }
+        const double inverse_weight = std::max(mean_diffusivity/(h*h), max_speed/(2.*h));
+        const double weight = (inverse_weight > 0.) ? 1./inverse_weight : 0.;
+
+        double squared_residual_norm = 0.;
+        for (unsigned int q = 0; q < n_q_points; ++q)
+        {
+            double residual = -scratch.diffusivities[q]*scratch.laplacians[q] - scratch.sources[q];
+            for (unsigned int i = 0; i < dim; ++i)
+            {
+                residual += scratch.velocities[q][i]*scratch.gradients[q][i];
+            }
+            if (include_time_derivative)
+            {
+                residual += (scratch.values[q] - scratch.old_values[q])/problem.time_step_size;
+            }
+            squared_residual_norm += residual*residual*fe_values.JxW(q);
+        }
+
+        double squared_jump_norm = 0.;
+        for (unsigned int f = 0; f < GeometryInfo<dim>::faces_per_cell; ++f)
+        {
+            if (cell->at_boundary(f))
+            {
+                continue;
+            }
+            if (dim == 1)
+            { /* The face is a vertex, shared with the active neighbor on any level. */
+                auto neighbor = cell->neighbor(f);
+                while (neighbor->has_children())
+                {
+                    neighbor = neighbor->child(1 - f);
+                }
+                scratch.fe_face_values.reinit(cell, f);
+                scratch.neighbor_fe_face_values.reinit(neighbor, 1 - f);
+                squared_jump_norm += integrate_squared_flux_jump(
+                    scratch.fe_face_values, scratch.neighbor_fe_face_values, problem, scratch);
+            }
+            else if (cell->face(f)->has_children())
+            { /* The neighbor is finer. */
+                const unsigned int neighbor_face = cell->neighbor_of_neighbor(f);
+                for (unsigned int subface = 0; subface < cell->face(f)->n_children(); ++subface)
+                {
+                    scratch.fe_subface_values->reinit(cell, f, subface);
+                    scratch.neighbor_fe_face_values.reinit(
+                        cell->neighbor_child_on_subface(f, subface), neighbor_face);
+                    squared_jump_norm += integrate_squared_flux_jump(
+                        *scratch.fe_subface_values, scratch.neighbor_fe_face_values, problem, scratch);
+                }
+            }
+            else if (cell->neighbor_is_coarser(f))
+            {
+                const std::pair<unsigned int, unsigned int> neighbor_face =
+                    cell->neighbor_of_coarser_neighbor(f);
+                scratch.fe_face_values.reinit(cell, f);
+                scratch.neighbor_fe_subface_values->reinit(
+                    cell->neighbor(f), neighbor_face.first, neighbor_face.second);
+                squared_jump_norm += integrate_squared_flux_jump(
+                    scratch.fe_face_values, *scratch.neighbor_fe_subface_values, problem, scratch);
+            }
+            else
+            {
+                scratch.fe_face_values.reinit(cell, f);
+                scratch.neighbor_fe_face_values.reinit(cell->neighbor(f), cell->neighbor_of_neighbor(f));
+                squared_jump_norm += integrate_squared_flux_jump(
+                    scratch.fe_face_values, scratch.neighbor_fe_face_values, problem, scratch);
+            }
+        }
+
+        copy_data.active_cell_index = cell->active_cell_index();
+        copy_data.estimated_error = std::sqrt(
+            weight*squared_residual_norm + 0.5*weight/h*squared_jump_norm);
+    }
+
+    /*! Estimate the error on every active cell.
+
+        The velocity, diffusivity and source functions should already be set to the time of the solution.
+        If the old solution is not defined on the same DoFs as the solution, then the time derivative is omitted.
+
+    */
+    template<int dim>
+    void estimate(
+        const DoFHandler<dim> &dof_handler,
+        const Quadrature<dim> &quadrature,
+        const Quadrature<dim-1> &face_quadrature,
+        const Vector<double> &solution,
+        const Vector<double> &old_solution,
+        const double time_step_size,
+        const Function<dim> &velocity,
+        const Function<dim> &diffusivity,
+        const Function<dim> &source,
+        Vector<float> &estimated_error_per_cell)
+    {
+        Assert(velocity.n_components == dim, ExcDimensionMismatch(velocity.n_components, dim));
+
+        const Problem<dim> problem = {&solution, &old_solution, time_step_size,
+            &velocity, &diffusivity, &source};
+
+        estimated_error_per_cell.reinit(dof_handler.get_triangulation().n_active_cells());
+
+        Scratch<dim> scratch(dof_handler.get_fe(), quadrature, face_quadrature);
+
+        CopyData copy_data;
+
+        typedef typename DoFHandler<dim>::active_cell_iterator ActiveCellIterator;
+
+        CellChunks::run(
+            dof_handler.begin_active(),
+            static_cast<ActiveCellIterator>(dof_handler.end()),
+            [&problem](const ActiveCellIterator &cell, Scratch<dim> &scratch, CopyData &copy_data)
+            {
+                estimate_on_cell<dim>(cell, problem, scratch, copy_data);
+            },
+            [&estimated_error_per_cell](const CopyData &copy_data)
+            {
+                estimated_error_per_cell(copy_data.active_cell_index) = copy_data.estimated_error;
+            },
+            scratch,
+            copy_data,
+            "estimate_cells",
+            "copy_estimates");
+    }
+
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef _sell_c_sigma_matrix_h_
+#define _sell_c_sigma_matrix_h_
+
+#include <deal.II/base/aligned_vector.h>
+#include <deal.II/base/exceptions.h>
+#include <deal.II/base/memory_consumption.h>
+#include <deal.II/base/parallel.h>
+#include <deal.II/lac/sparse_matrix.h>
+#include <deal.II/lac/vector.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#include "tracing.h"
+
+/**
+ * @brief A sliced ELLPACK (SELL-C-sigma) copy of a SparseMatrix, for fast matrix-vector products.
+ *
+ * @detail
+ *
+ *    The rows are grouped into chunks of C rows, and every chunk is stored column-major
+ *    and padded to the length of its longest row.
+ *    The inner loop of the product then runs over the C rows of a chunk with unit stride,
+ *    which the compiler can vectorize, instead of over the few entries of one CSR row.
+ *    To keep the padding small, the rows are sorted by length within windows of sigma rows.
+ *    Column indices are stored as 32-bit integers, which saves memory traffic.
+ *
+ *    The chunks are distributed over the threads with parallel::apply_to_subranges.
+ *
+ *    The structure is copied once per sparsity pattern with reinit(),
+ *    and the values of every matrix with that sparsity pattern can then be refreshed with copy_values_from().
+ *    Only vmult and vmult_add are provided, which is all that the Krylov solvers need;
+ *    the preconditioners still work on the original SparseMatrix.
+*/
+namespace SellCSigma
+{
+    using namespace dealii;
+
+    /*! The number of rows of a chunk, i.e. C. Eight doubles fill one AVX-512 register, or two AVX registers. */
+    const unsigned int chunk_size = 8;
+
+    /*! The default sorting window, i.e. sigma */
+    const unsigned int default_sorting_scope = 32*chunk_size;
+
+    /*! The number of chunks which are processed by one task */
+    const unsigned int chunks_per_task = 64;
+
+    class Matrix
+    {
+    public:
+        Matrix()
+            :
+            n_rows(0),
+            n_cols(0),
+            n_nonzero(0)
+        {}
+
+        /*! Copy the structure and values of the matrix */
+        void reinit(const SparseMatrix<double> &matrix,
+            const unsigned int sorting_scope = default_sorting_scope)
+        {
+            Assert(sorting_scope % chunk_size == 0, ExcMessage("sigma must be a multiple of C."));
+
+            AssertThrow(matrix.n() < std::numeric_limits<unsigned int>::max(),
+                ExcMessage("SELL-C-sigma stores 32-bit column indices."));
+
+            this->n_rows = matrix.m();
+
+            this->n_cols = matrix.n();
+
+            this->n_nonzero = matrix.n_nonzero_elements();
+
+            const unsigned int n_chunks = (this->n_rows + chunk_size - 1)/chunk_size;
+
+            const types::global_dof_index padded_rows = n_chunks*chunk_size;
+
+            /* Sort the rows by decreasing length within every window of sigma rows */
+            std::vector<unsigned int> row_lengths(padded_rows, 0);
+
+            for (types::global_dof_index row = 0; row < this->n_rows; ++row)
+            {
+                row_lengths[row] = matrix.get_sparsity_pattern().row_length(row);
+            }
+
+            this->rows.resize(padded_rows);
+
+            std::iota(this->rows.begin(), this->rows.end(), 0);
+
+            for (types::global_dof_index window = 0; window < padded_rows; window += sorting_scope)
+            {
+                std::stable_sort(
+                    this->rows.begin() + window,
+                    this->rows.begin() + std::min<types::global_dof_index>(window + sorting_scope, padded_rows),
+                    [&row_lengths](const unsigned int a, const unsigned int b)
+                    {
+                        return row_lengths[a] > row_lengths[b];
+                    });
+            }
+
+            /* Pad every chunk to its longest row */
+            this->chunk_starts.resize(n_chunks + 1);
+
+            this->chunk_starts[0] = 0;
+
+            for (unsigned int chunk = 0; chunk < n_chunks; ++chunk)
+            {
+                unsigned int width = 0;
+
+                for (unsigned int lane = 0; lane < chunk_size; ++lane)
+                {
+                    width = std::max(width, row_lengths[this->rows[chunk*chunk_size + lane]]);
+                }
+
+                this->chunk_starts[chunk + 1] = this->chunk_starts[chunk] + std::size_t(width)*chunk_size;
+            }
+
+            /* Padded entries are zeros which repeat the last column of their row, or the first column, so that
+            the product reads a vector entry which is already cached. */
+            this->columns.assign(this->chunk_starts[n_chunks], 0);
+
+            for (unsigned int chunk = 0; chunk < n_chunks; ++chunk)
+            {
+                for (unsigned int lane = 0; lane < chunk_size; ++lane)
+                {
+                    const unsigned int row = this->rows[chunk*chunk_size + lane];
+
+                    if (row >= this->n_rows)
+                    {
+                        continue;
+                    }
+
+                    std::size_t index = this->chunk_starts[chunk] + lane;
+
+                    unsigned int column = 0;
+
+                    for (auto entry = matrix.begin(row); entry != matrix.end(row); ++entry)
+                    {
+                        column = entry->column();
+
+                        this->columns[index] = column;
+
+                        index += chunk_size;
+                    }
+
+                    for (; index < this->chunk_starts[chunk + 1]; index += chunk_size)
+                    {
+                        this->columns[index] = column;
+                    }
+                }
+            }
+
+            this->values.resize(this->chunk_starts[n_chunks]);
+
+            this->copy_values_from(matrix);
+        }
+
+        /*! Copy the values of a matrix which has the sparsity pattern of the matrix given to reinit */
+        void copy_values_from(const SparseMatrix<double> &matrix)
+        {
+            Assert((matrix.m() == this->n_rows) && (matrix.n_nonzero_elements() == this->n_nonzero),
+                ExcMessage("The sparsity pattern differs from the one given to reinit."));
+
+            const unsigned int n_chunks = this->chunk_starts.size() - 1;
+
+            parallel::apply_to_subranges(0U, n_chunks,
+                [this, &matrix](const unsigned int begin, const unsigned int end)
+                {
+                    for (unsigned int chunk = begin; chunk < end; ++chunk)
+                    {
+                        for (unsigned int lane = 0; lane < chunk_size; ++lane)
+                        {
+                            const unsigned int row = this->rows[chunk*chunk_size + lane];
+
+                            std::size_t index = this->chunk_starts[chunk] + lane;
+
+                            if (row < this->n_rows)
+                            {
+                                for (auto entry = matrix.begin(row); entry != matrix.end(row); ++entry)
+                                {
+                                    this->values[index] = entry->value();
+
+                                    index += chunk_size;
+                                }
+                            }
+
+                            for (; index < this->chunk_starts[chunk + 1]; index += chunk_size)
+                            {
+                                this->values[index] = 0.;
+                            }
+                        }
+                    }
+                },
+                chunks_per_task);
+        }
+
+        /*! dst = M*src */
+        void vmult(Vector<double> &dst, const Vector<double> &src) const
+        {
+            this->apply(dst, src, false);
+        }
+
+        /*! dst += M*src */
+        void vmult_add(Vector<double> &dst, const Vector<double> &src) const
+        {
+            this->apply(dst, src, true);
+        }
+
+        types::global_dof_index m() const
+        {
+            return this->n_rows;
+        }
+
+        types::global_dof_index n() const
+        {
+            return this->n_cols;
+        }
+
+        /*! The fraction of the stored entries which are not padding */
+        double fill_ratio() const
+        {
+            return this->values.size() == 0 ? 1. : double(this->n_nonzero)/double(this->values.size());
+        }
+
+        std::size_t memory_consumption() const
+        {
+            return MemoryConsumption::memory_consumption(this->rows)
+                + MemoryConsumption::memory_consumption(this->chunk_starts)
+                + MemoryConsumption::memory_consumption(this->columns)
+                + this->values.memory_consumption();
+        }
+
+    private:
+        void apply(Vector<double> &dst, const Vector<double> &src, const bool add) const
+        {
+            Assert(dst.size() == this->n_rows, ExcDimensionMismatch(dst.size(), this->n_rows));
+
+            Assert(src.size() == this->n_cols, ExcDimensionMismatch(src.size(), this->n_cols));
+
+            Tracing::Scope trace("sell_c_sigma_vmult");
+
+            const unsigned int n_chunks = this->chunk_starts.size() - 1;
+
+            const double *const x = src.begin();
+
+            double *const y = dst.begin();
+
+            parallel::apply_to_subranges(0U, n_chunks,
+                [this, x, y, add](const unsigned int begin, const unsigned int end)
+                {
+                    for (unsigned int chunk = begin; chunk < end; ++chunk)
+                    {
+                        double sums[chunk_size] = {};
+
+                        const double *value = this->values.begin() + this->chunk_starts[chunk];
+
+                        const unsigned int *column = this->columns.data() + this->chunk_starts[chunk];
+
+                        const unsigned int width = (this->chunk_starts[chunk + 1] - this->chunk_starts[chunk])/chunk_size;
+
+                        for (unsigned int j = 0; j < width; ++j)
+                        {
+                            DEAL_II_OPENMP_SIMD_PRAGMA
+                            for (unsigned int lane = 0; lane < chunk_size; ++lane)
+                            {
+                                sums[lane] += value[lane]*x[column[lane]];
+                            }
+
+                            value += chunk_size;
+
+                            column += chunk_size;
+                        }
+
+                        for (unsigned int lane = 0; lane < chunk_size; ++lane)
+                        {
+                            const unsigned int row = this->rows[chunk*chunk_size + lane];
+
+                            if (row < this->n_rows)
+                            {
+                                y[row] = add ? (y[row] + sums[lane]) : sums[lane];
+                            }
+                        }
+                    }
+                },
+                chunks_per_task);
+        }
+
+        types::global_dof_index n_rows;
+
+        types::global_dof_index n_cols;
+
+        std::size_t n_nonzero;
+
+        /*! The original row of every slot, chunk by chunk; slots past the last row are padding */
+        std::vector<unsigned int> rows;
+
+        /*! The index of the first stored entry of every chunk, and the total number of stored entries */
+        std::vector<std::size_t> chunk_starts;
+
+        std::vector<unsigned int> columns;
+
+        AlignedVector<double> values;
+    };
+
+}
+
+#endif
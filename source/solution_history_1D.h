@@ -0,0 +1,159 @@
+#ifndef solution_history_1D_h
+#define solution_history_1D_h
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+/*! Streams the history of a 1D solution to a binary columnar file.
+
+    Each output step is appended as one record and flushed immediately, so memory use is constant over the run
+    and the history written so far survives a crash.
+
+    The file starts with an eight character magic string and a format version.
+    Each record then contains
+        - the time as a double
+        - the number of samples, n, as a 64 bit unsigned integer
+        - n doubles for the vertex coordinates, sorted in ascending order
+        - n doubles for the solution values at those vertices
+
+    Use SolutionHistory1D::export_to_text to write the same data in the tabular text format,
+    e.g. for importing into MATLAB.
+
+*/
+namespace SolutionHistory1D
+{
+    const char MAGIC[8] = {'P', 'E', 'C', 'L', 'E', 'T', '1', 'D'};
+
+    const std::uint32_t VERSION = 1;
+
+    /*! Open the history file, discarding any previous contents, and write the file header. */
+    inline void open(std::ofstream &file_stream, const std::string file_path)
+    {
+        if (file_stream.is_open())
+        {
+            file_stream.close();
+        }
+        file_stream.open(file_path, std::ios::binary | std::ios::trunc);
+        if (!file_stream.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + file_path);
+        }
+        file_stream.write(MAGIC, sizeof(MAGIC));
+        file_stream.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+        file_stream.flush();
+    }
+
+    /*! Re-open an existing history file for appending, after truncating it to the given size.
+    
+        This is used to resume a run from a checkpoint, which records the size of the history at that point.
+    
+    */
+    inline void reopen(std::ofstream &file_stream, const std::string file_path, const std::uint64_t size)
+    {
+        if (file_stream.is_open())
+        {
+            file_stream.close();
+        }
+        if (truncate(file_path.c_str(), size) != 0)
+        {
+            throw std::runtime_error("Error while truncating the file: " + file_path);
+        }
+        file_stream.open(file_path, std::ios::binary | std::ios::app | std::ios::ate);
+        if (!file_stream.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + file_path);
+        }
+    }
+
+    /*! Append the samples of one output step and flush them to disk.
+
+        The samples are sorted by coordinate in place.
+
+    */
+    inline void append_step(
+        std::ofstream &file_stream,
+        const double time,
+        std::vector<std::pair<double, double>> &samples)
+    {
+        std::sort(samples.begin(), samples.end());
+        const std::uint64_t sample_count = samples.size();
+        file_stream.write(reinterpret_cast<const char*>(&time), sizeof(time));
+        file_stream.write(reinterpret_cast<const char*>(&sample_count), sizeof(sample_count));
+        for (auto &sample : samples)
+        {
+            file_stream.write(reinterpret_cast<const char*>(&sample.first), sizeof(double));
+        }
+        for (auto &sample : samples)
+        {
+            file_stream.write(reinterpret_cast<const char*>(&sample.second), sizeof(double));
+        }
+        file_stream.flush();
+        if (!file_stream.good())
+        {
+            throw std::runtime_error("Error while writing the 1D solution history");
+        }
+    }
+
+    /*! Export a history file to a text table with columns t, x0, u0.
+
+        Records are read one at a time, so this also runs in constant memory.
+        A truncated final record, e.g. from a crashed run, is ignored.
+
+    */
+    inline void export_to_text(const std::string binary_file_path, const std::string text_file_path)
+    {
+        std::ifstream in_file(binary_file_path, std::ios::binary);
+        if (!in_file.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + binary_file_path);
+        }
+        char magic[sizeof(MAGIC)];
+        std::uint32_t version;
+        in_file.read(magic, sizeof(magic));
+        in_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!in_file.good() || !std::equal(magic, magic + sizeof(magic), MAGIC) || (version != VERSION))
+        {
+            throw std::runtime_error("Not a 1D solution history file: " + binary_file_path);
+        }
+
+        std::ofstream out_file(text_file_path);
+        if (!out_file.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + text_file_path);
+        }
+        const int precision = 14;
+        out_file << std::scientific << std::setprecision(precision);
+        out_file << "t x0 u0" << std::endl;
+
+        std::vector<double> x, u;
+        double time;
+        std::uint64_t sample_count;
+        while (in_file.read(reinterpret_cast<char*>(&time), sizeof(time))
+               && in_file.read(reinterpret_cast<char*>(&sample_count), sizeof(sample_count)))
+        {
+            x.resize(sample_count);
+            u.resize(sample_count);
+            in_file.read(reinterpret_cast<char*>(x.data()), sample_count*sizeof(double));
+            in_file.read(reinterpret_cast<char*>(u.data()), sample_count*sizeof(double));
+            if (!in_file.good())
+            {
+                break;
+            }
+            for (std::uint64_t i = 0; i < sample_count; ++i)
+            {
+                out_file << time << " " << x[i] << " " << u[i] << "\n";
+            }
+        }
+    }
+
+}
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef _spatial_index_h_
+#define _spatial_index_h_
+
+#include <deal.II/base/point.h>
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Static spatial indices for repeated point queries on a fixed mesh.
+ *
+ * @detail
+ *
+ *    Both trees are built once, in O(N log N), and then answer queries in O(log N) on average.
+ *    Neither tree can be modified after it has been built.
+*/
+namespace SpatialIndex
+{
+    using namespace dealii;
+
+    /*! An axis-aligned bounding box, given by its lower and upper corners */
+    template<int dim>
+    using Box = std::pair<Point<dim>, Point<dim>>;
+
+    /*! A k-d tree for nearest neighbor queries on a set of points */
+    template<int dim>
+    class KDTree
+    {
+    public:
+        KDTree() {}
+
+        KDTree(const std::vector<Point<dim>> &points)
+        {
+            this->build(points);
+        }
+
+        void build(const std::vector<Point<dim>> &points)
+        {
+            this->points = points;
+            this->indices.resize(points.size());
+            std::iota(this->indices.begin(), this->indices.end(), 0);
+            this->build_recursively(0, this->indices.size(), 0);
+        }
+
+        unsigned int size() const
+        {
+            return this->points.size();
+        }
+
+        /*! Return the index of the point nearest to the given point. The tree must not be empty. */
+        unsigned int nearest(const Point<dim> &point) const
+        {
+            Assert(this->size() > 0, ExcInternalError());
+            unsigned int nearest_index = 0;
+            double nearest_distance = std::numeric_limits<double>::max();
+            this->search_recursively(point, 0, this->indices.size(), 0,
+                nearest_index, nearest_distance);
+            return nearest_index;
+        }
+
+    private:
+        std::vector<Point<dim>> points;
+
+        /*! Point indices, ordered such that every median of a sub-range splits that sub-range */
+        std::vector<unsigned int> indices;
+
+        void build_recursively(const unsigned int begin, const unsigned int end,
+                               const unsigned int axis)
+        {
+            if (end - begin < 2)
+            {
+                return;
+            }
+            const unsigned int middle = begin + (end - begin)/2;
+            std::nth_element(
+                this->indices.begin() + begin,
+                this->indices.begin() + middle,
+                this->indices.begin() + end,
+                [this, axis](const unsigned int a, const unsigned int b)
+                {
+                    return this->points[a][axis] < this->points[b][axis];
+                });
+            this->build_recursively(begin, middle, (axis + 1) % dim);
+            this->build_recursively(middle + 1, end, (axis + 1) % dim);
+        }
+
+        void search_recursively(const Point<dim> &point,
+                                const unsigned int begin, const unsigned int end,
+                                const unsigned int axis,
+                                unsigned int &nearest_index,
+                                double &nearest_distance) const
+        {
+            if (begin >= end)
+            {
+                return;
+            }
+            const unsigned int middle = begin + (end - begin)/2;
+            const unsigned int index = this->indices[middle];
+            const double distance = (point - this->points[index]).norm_square();
+            if (distance < nearest_distance)
+            {
+                nearest_index = index;
+                nearest_distance = distance;
+            }
+            const double offset = point[axis] - this->points[index][axis];
+            const unsigned int next_axis = (axis + 1) % dim;
+            if (offset < 0.)
+            {
+                this->search_recursively(point, begin, middle, next_axis,
+                    nearest_index, nearest_distance);
+                if (offset*offset < nearest_distance)
+                {
+                    this->search_recursively(point, middle + 1, end, next_axis,
+                        nearest_index, nearest_distance);
+                }
+            }
+            else
+            {
+                this->search_recursively(point, middle + 1, end, next_axis,
+                    nearest_index, nearest_distance);
+                if (offset*offset < nearest_distance)
+                {
+                    this->search_recursively(point, begin, middle, next_axis,
+                        nearest_index, nearest_distance);
+                }
+            }
+        }
+    };
+
+    /*! A bounding volume hierarchy for finding the boxes which contain a point */
+    template<int dim>
+    class BoxTree
+    {
+    public:
+        BoxTree() {}
+
+        BoxTree(const std::vector<Box<dim>> &boxes)
+        {
+            this->build(boxes);
+        }
+
+        void build(const std::vector<Box<dim>> &boxes)
+        {
+            this->boxes = boxes;
+            this->indices.resize(boxes.size());
+            std::iota(this->indices.begin(), this->indices.end(), 0);
+            this->nodes.clear();
+            if (boxes.size() > 0)
+            {
+                this->build_recursively(0, boxes.size());
+            }
+        }
+
+        /*! Append the indices of all boxes which contain the point to candidates */
+        void find(const Point<dim> &point, std::vector<unsigned int> &candidates) const
+        {
+            if (this->nodes.size() > 0)
+            {
+                this->find_recursively(point, 0, candidates);
+            }
+        }
+
+    private:
+        static const unsigned int max_leaf_size = 8;
+
+        struct Node
+        {
+            Box<dim> box;
+            unsigned int begin, end;
+            unsigned int left_child, right_child;
+        };
+
+        std::vector<Box<dim>> boxes;
+
+        std::vector<unsigned int> indices;
+
+        std::vector<Node> nodes;
+
+        static bool contains(const Box<dim> &box, const Point<dim> &point)
+        {
+            for (unsigned int axis = 0; axis < dim; ++axis)
+            {
+                if ((point[axis] < box.first[axis]) || (point[axis] > box.second[axis]))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        unsigned int build_recursively(const unsigned int begin, const unsigned int end)
+        {
+            Node node;
+            node.begin = begin;
+            node.end = end;
+            node.box = this->boxes[this->indices[begin]];
+            for (unsigned int i = begin + 1; i < end; ++i)
+            {
+                const Box<dim> &box = this->boxes[this->indices[i]];
+                for (unsigned int axis = 0; axis < dim; ++axis)
+                {
+                    node.box.first[axis] = std::min(node.box.first[axis], box.first[axis]);
+                    node.box.second[axis] = std::max(node.box.second[axis], box.second[axis]);
+                }
+            }
+            const unsigned int node_index = this->nodes.size();
+            this->nodes.push_back(node);
+            if (end - begin <= max_leaf_size)
+            {
+                this->nodes[node_index].left_child = 0;
+                this->nodes[node_index].right_child = 0;
+                return node_index;
+            }
+            /* Split at the median box center along the longest axis. */
+            unsigned int split_axis = 0;
+            for (unsigned int axis = 1; axis < dim; ++axis)
+            {
+                if ((node.box.second[axis] - node.box.first[axis]) >
+                    (node.box.second[split_axis] - node.box.first[split_axis]))
+                {
+                    split_axis = axis;
+                }
+            }
+            const unsigned int middle = begin + (end - begin)/2;
+            std::nth_element(
+                this->indices.begin() + begin,
+                this->indices.begin() + middle,
+                this->indices.begin() + end,
+                [this, split_axis](const unsigned int a, const unsigned int b)
+                {
+                    return (this->boxes[a].first[split_axis] + this->boxes[a].second[split_axis]) <
+                        (this->boxes[b].first[split_axis] + this->boxes[b].second[split_axis]);
+                });
+            const unsigned int left_child = this->build_recursively(begin, middle);
+            const unsigned int right_child = this->build_recursively(middle, end);
+            this->nodes[node_index].left_child = left_child;
+            this->nodes[node_index].right_child = right_child;
+            return node_index;
+        }
+
+        void find_recursively(const Point<dim> &point, const unsigned int node_index,
+                              std::vector<unsigned int> &candidates) const
+        {
+            const Node &node = this->nodes[node_index];
+            if (!contains(node.box, point))
+            {
+                return;
+            }
+            if (node.left_child == 0)
+            {
+                for (unsigned int i = node.begin; i < node.end; ++i)
+                {
+                    if (contains(this->boxes[this->indices[i]], point))
+                    {
+                        candidates.push_back(this->indices[i]);
+                    }
+                }
+                return;
+            }
+            this->find_recursively(point, node.left_child, candidates);
+            this->find_recursively(point, node.right_child, candidates);
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _streamline_diffusion_h_
+#define _streamline_diffusion_h_
+
+#include <deal.II/lac/vector.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief The stabilization parameter for the streamline upwind Petrov-Galerkin (SUPG) method.
+ *
+ * @detail
+ *
+ *    With SUPG, the test functions w are replaced by w + tau v . grad w.
+ *    This adds numerical diffusion only along the streamlines, and is consistent,
+ *    i.e. it is applied to the full residual including the time derivative and the source.
+ *
+ *    The standard design is the optimal parameter for the 1D steady problem with linear elements,
+ *
+ *        tau = h/(2|v|) (coth(Pe) - 1/Pe),  Pe = |v| h/(2 alpha),
+ *
+ *    as in Finite Element Methods for Flow Problems (Donea & Huerta, 2003).
+*/
+namespace StreamlineDiffusion
+{
+    using namespace dealii;
+
+    /*! Compute tau for the element size h, the speed |v| and the diffusivity alpha */
+    inline double parameter(const double h, const double speed, const double diffusivity)
+    {
+        if (speed <= 0.)
+        {
+            return 0.;
+        }
+        if (diffusivity <= 0.)
+        {
+            return h/(2.*speed);
+        }
+        const double peclet = speed*h/(2.*diffusivity);
+        /* coth(Pe) - 1/Pe = Pe/3 + O(Pe^3), which avoids cancellation for small Pe */
+        const double xi = (peclet < 1.e-3) ? peclet/3. : 1./std::tanh(peclet) - 1./peclet;
+        return h/(2.*speed)*xi;
+    }
+
+    /*! Compute tau for one cell, from the coefficients at its quadrature points
+
+        The element size is the cell diameter divided by the polynomial degree,
+        with the maximum speed and the mean diffusivity over the cell.
+
+    */
+    inline double cell_parameter(
+        const double cell_diameter,
+        const unsigned int degree,
+        const std::vector<Vector<double>> &velocity_values,
+        const std::vector<double> &diffusivity_values,
+        const unsigned int n_q_points)
+    {
+        double max_speed = 0., mean_diffusivity = 0.;
+        for (unsigned int q = 0; q < n_q_points; ++q)
+        {
+            max_speed = std::max(max_speed, velocity_values[q].l2_norm());
+            mean_diffusivity += diffusivity_values[q]/n_q_points;
+        }
+        return parameter(cell_diameter/degree, max_speed, mean_diffusivity);
+    }
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef _tracing_h_
+#define _tracing_h_
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A timeline of begin and end events per thread, written in the Chrome trace-event format.
+ *
+ * @detail
+ *
+ *    Aggregate timers can not show load imbalance or serialization between threads,
+ *    e.g. the sequential copier of a WorkStream. A trace can, when opened in chrome://tracing or Perfetto.
+ *
+ *    Every thread appends to its own buffer, so recording an event takes no lock.
+ *    Only the first event of each thread registers its buffer, under a mutex.
+ *    enable() registers the buffer of the main thread, so that it is named "main" in the trace.
+ *    Buffers outlive their threads, and are only read by write(), which must not run concurrently with recording.
+ *
+ *    Event names must be string literals, or otherwise outlive the trace.
+ *
+ *    While tracing is disabled, which is the default, recording an event is a single relaxed atomic load.
+*/
+namespace Tracing
+{
+    struct Event
+    {
+        const char *name;
+        char phase;
+        double microseconds;
+    };
+
+    struct ThreadBuffer
+    {
+        unsigned int thread_index;
+        std::vector<Event> events;
+    };
+
+    /*! The state shared by all threads */
+    struct Trace
+    {
+        Trace() : enabled(false), start(std::chrono::steady_clock::now()), main_thread_index(0) {}
+
+        std::atomic<bool> enabled;
+
+        std::chrono::steady_clock::time_point start;
+
+        /*! The index of the buffer of the thread which called enable() */
+        unsigned int main_thread_index;
+
+        std::mutex mutex;
+
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    };
+
+    inline Trace &trace()
+    {
+        static Trace instance;
+        return instance;
+    }
+
+    inline bool enabled()
+    {
+        return trace().enabled.load(std::memory_order_relaxed);
+    }
+
+    inline ThreadBuffer &thread_buffer()
+    {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        if (!buffer)
+        {
+            buffer = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(trace().mutex);
+            buffer->thread_index = trace().buffers.size();
+            trace().buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    /*! Start recording, with timestamps relative to now
+
+        This must be called by the main thread, which is named so in the trace.
+
+    */
+    inline void enable()
+    {
+        trace().main_thread_index = thread_buffer().thread_index;
+        trace().start = std::chrono::steady_clock::now();
+        trace().enabled.store(true);
+    }
+
+    inline void record(const char *name, const char phase)
+    {
+        const double microseconds = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - trace().start).count();
+        thread_buffer().events.push_back({name, phase, microseconds});
+    }
+
+    inline void begin(const char *name)
+    {
+        if (enabled())
+        {
+            record(name, 'B');
+        }
+    }
+
+    inline void end(const char *name)
+    {
+        if (enabled())
+        {
+            record(name, 'E');
+        }
+    }
+
+    /*! Record a begin event now and the matching end event at destruction */
+    class Scope
+    {
+    public:
+        Scope(const char *name)
+            :
+            name(enabled() ? name : nullptr)
+        {
+            if (this->name)
+            {
+                record(this->name, 'B');
+            }
+        }
+
+        ~Scope()
+        {
+            if (this->name)
+            {
+                record(this->name, 'E');
+            }
+        }
+
+    private:
+        const char *name;
+    };
+
+    /*! Write all recorded events to a JSON file in the Chrome trace-event format */
+    inline void write(const std::string &file_path)
+    {
+        std::ofstream file(file_path);
+        if (!file.good())
+        {
+            throw std::runtime_error("Error while opening the file: " + file_path);
+        }
+        std::lock_guard<std::mutex> lock(trace().mutex);
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        for (auto &buffer : trace().buffers)
+        {
+            file << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                << buffer->thread_index << ", \"args\": {\"name\": \""
+                << ((buffer->thread_index == trace().main_thread_index) ? "main" : "worker")
+                << " " << buffer->thread_index << "\"}}";
+            first = false;
+            for (auto &event : buffer->events)
+            {
+                file << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"" << event.phase
+                    << "\", \"ts\": " << std::fixed << event.microseconds << std::defaultfloat
+                    << ", \"pid\": 1, \"tid\": " << buffer->thread_index << "}";
+            }
+        }
+        file << "\n]}\n";
+    }
+
+}
+
+#endif
@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+"""Accuracy regression test of a case, which checks the solution computed by peclet against a known property.
+
+supg_nodal_exactness: Run a steady 1D convection-diffusion case with constant coefficients and source
+with SUPG, until it reaches its steady state. With the optimal stabilization parameter, the nodal values
+of the linear finite element solution equal the exact solution. The case must write its final time step
+to the 1D solution history.
+
+downwind_renumbering, hilbert_renumbering: Run a case with verification enabled, once as it is and once with
+solver.dof_renumbering = downwind or hilbert. Renumbering the DoFs only changes the order of the unknowns,
+so the errors with respect to the exact solution must agree at every output step, up to the solver tolerance.
+
+sell_c_sigma: Run a case with verification enabled, once as it is and once with solver.matrix_format = sell_c_sigma.
+The SELL-C-sigma copies hold the same matrices, so the errors must agree, and the Krylov iterations of every
+solve must agree within one, which allows for a different rounding of the products.
+
+residual_estimator_refines_layer: Run a steady 1D case with a boundary layer at x = 1, whose initial values
+are the exact solution, with adaptive refinement by the residual estimator. The smallest cell of the final grid
+must be the one at x = 1, and it must be smaller than the initial cells, while the cells of the smooth half
+x <= 1/2 must keep the initial size. The case must write its final time step to the 1D solution history.
+"""
+import argparse
+import math
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+
+HISTORY_1D_MAGIC = b"PECLET1D"
+
+HISTORY_1D_FILE_NAME = "1D_solution_history.bin"
+
+"""The velocity, diffusivity and source of the supg_nodal_exactness case"""
+VELOCITY = 1.
+DIFFUSIVITY = 0.01
+SOURCE = 1.
+
+NODAL_TOLERANCE = 1.e-8
+
+"""The initial cell size of the residual_estimator_refines_layer case"""
+INITIAL_CELL_SIZE = 1./16.
+
+"""The relative tolerance of cell sizes, which are differences of the vertex positions"""
+CELL_SIZE_TOLERANCE = 1.e-9
+
+"""The relative tolerance of errors which must agree, which allows for the different rounding of the Krylov solves"""
+ERROR_TOLERANCE = 1.e-3
+
+VERIFICATION_TABLE_FILE_NAME = "verification_table.txt"
+
+SOLVER_OVERRIDES = """
+# Overrides of the accuracy regression test
+subsection solver
+    set {} = {}
+end
+"""
+
+
+def run(peclet, work_dir, arguments):
+    """Run peclet in the work directory, and return its standard output"""
+    result = subprocess.run([os.path.abspath(peclet)] + arguments,
+        cwd=work_dir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    print(result.stdout)
+    result.check_returncode()
+    return result.stdout
+
+
+def write_case(work_dir, case, overrides=""):
+    if os.path.isdir(work_dir):
+        shutil.rmtree(work_dir)
+    os.makedirs(work_dir)
+    with open(os.path.join(work_dir, "case.prm"), "w") as file:
+        file.write(case + overrides)
+
+
+def read_history_1D(file_path):
+    """Return the records of a 1D solution history as (time, positions, values), see solution_history_1D.h"""
+    with open(file_path, "rb") as file:
+        data = file.read()
+    if data[:len(HISTORY_1D_MAGIC)] != HISTORY_1D_MAGIC:
+        raise RuntimeError("Not a 1D solution history file: " + file_path)
+    records = []
+    offset = len(HISTORY_1D_MAGIC) + 4
+    while offset + 16 <= len(data):
+        time, count = struct.unpack_from("<dQ", data, offset)
+        offset += 16
+        if offset + 16*count > len(data):
+            break
+        positions = struct.unpack_from("<{}d".format(count), data, offset)
+        values = struct.unpack_from("<{}d".format(count), data, offset + 8*count)
+        offset += 16*count
+        records.append((time, positions, values))
+    return records
+
+
+def steady_solution(x):
+    """The solution of -alpha u'' + v u' = s on (0, 1), with u(0) = u(1) = 0"""
+    return SOURCE/VELOCITY*(x - math.expm1(VELOCITY*x/DIFFUSIVITY)/math.expm1(VELOCITY/DIFFUSIVITY))
+
+
+def check_supg_nodal_exactness(peclet, case, work_dir):
+    write_case(work_dir, case)
+    output = run(peclet, work_dir, ["case.prm"])
+
+    if "Reached steady state" not in output:
+        print("The case did not reach its steady state.")
+        return 1
+
+    time, positions, values = read_history_1D(os.path.join(work_dir, HISTORY_1D_FILE_NAME))[-1]
+
+    error, position = max((abs(value - steady_solution(x)), x) for x, value in zip(positions, values))
+
+    if error > NODAL_TOLERANCE:
+        print("The nodal error at t = {} is {:.3e} at x = {}, which exceeds {:.0e}.".format(
+            time, error, position, NODAL_TOLERANCE))
+        return 1
+
+    print("The largest nodal error at t = {} is {:.3e}.".format(time, error))
+    return 0
+
+
+def read_verification_table(file_path):
+    """Return the rows of a verification table, see Peclet::write_verification_table, as dictionaries"""
+    with open(file_path) as file:
+        rows = [line.split() for line in file if line.strip()]
+    return [dict(zip(rows[0], [float(value) for value in row])) for row in rows[1:]]
+
+
+def read_iterations(output):
+    return [int(count) for count in re.findall(r"^\s+(\d+) \S+ iterations\.$", output, re.MULTILINE)]
+
+
+def check_matches_reference(peclet, case, work_dir, overrides, compare_iterations):
+    """Run the case as it is and with the overrides, and compare their errors and optionally their iterations"""
+    outputs, tables = [], []
+    for name, case_overrides in [("reference", ""), ("variant", overrides)]:
+        run_dir = os.path.join(work_dir, name)
+        write_case(run_dir, case, case_overrides)
+        outputs.append(run(peclet, run_dir, ["case.prm"]))
+        tables.append(read_verification_table(os.path.join(run_dir, VERIFICATION_TABLE_FILE_NAME)))
+
+    reference_table, variant_table = tables
+    if (len(reference_table) == 0) or (len(variant_table) != len(reference_table)):
+        print("The verification tables have {} and {} rows.".format(len(reference_table), len(variant_table)))
+        return 1
+
+    failures = []
+    for reference_row, variant_row in zip(reference_table, variant_table):
+        for name in ["L1_norm_error", "L2_norm_error"]:
+            if abs(variant_row[name] - reference_row[name]) > ERROR_TOLERANCE*reference_row[name]:
+                failures.append("{} at t = {} is {:.6e} instead of {:.6e}".format(
+                    name, reference_row["time"], variant_row[name], reference_row[name]))
+
+    reference_iterations, variant_iterations = [read_iterations(output) for output in outputs]
+    print("The Krylov solves took {} iterations, and {} in the reference run.".format(
+        sum(variant_iterations), sum(reference_iterations)))
+
+    if compare_iterations:
+        if (len(variant_iterations) != len(reference_iterations)) or any(
+                abs(variant - reference) > 1 for variant, reference in zip(variant_iterations, reference_iterations)):
+            failures.append("the iterations per step {} instead of {}".format(
+                variant_iterations, reference_iterations))
+
+    if failures:
+        print("The run differs from the reference run in: " + "; ".join(failures) + ".")
+        return 1
+
+    print("The run agrees with the reference run at all {} output steps.".format(len(reference_table)))
+    return 0
+
+
+def check_downwind_renumbering(peclet, case, work_dir):
+    return check_matches_reference(peclet, case, work_dir,
+        SOLVER_OVERRIDES.format("dof_renumbering", "downwind"), compare_iterations=False)
+
+
+def check_hilbert_renumbering(peclet, case, work_dir):
+    return check_matches_reference(peclet, case, work_dir,
+        SOLVER_OVERRIDES.format("dof_renumbering", "hilbert"), compare_iterations=False)
+
+
+def check_sell_c_sigma(peclet, case, work_dir):
+    return check_matches_reference(peclet, case, work_dir,
+        SOLVER_OVERRIDES.format("matrix_format", "sell_c_sigma"), compare_iterations=True)
+
+
+def check_residual_estimator_refines_layer(peclet, case, work_dir):
+    write_case(work_dir, case)
+    run(peclet, work_dir, ["case.prm"])
+
+    time, positions, values = read_history_1D(os.path.join(work_dir, HISTORY_1D_FILE_NAME))[-1]
+
+    vertices = sorted(set(positions))
+    cells = [(left, right - left) for left, right in zip(vertices[:-1], vertices[1:])]
+    if not cells:
+        print("The 1D solution history at t = {} has no cells.".format(time))
+        return 1
+
+    smallest = min(size for left, size in cells)
+
+    failures = []
+    if smallest >= INITIAL_CELL_SIZE*(1. - CELL_SIZE_TOLERANCE):
+        failures.append("no cell was refined")
+    if cells[-1][1] > smallest*(1. + CELL_SIZE_TOLERANCE):
+        failures.append("the cell at x = 1 has the size {:.3e}, but the smallest cell has {:.3e}".format(
+            cells[-1][1], smallest))
+    changed = [left for left, size in cells
+        if (left + size <= 0.5 + CELL_SIZE_TOLERANCE) and
+            (abs(size - INITIAL_CELL_SIZE) > INITIAL_CELL_SIZE*CELL_SIZE_TOLERANCE)]
+    if changed:
+        failures.append("the cells at x = {} in the smooth half changed their size".format(changed))
+
+    if failures:
+        print("The grid at t = {} is wrong: ".format(time) + "; ".join(failures) + ".")
+        return 1
+
+    print("The grid at t = {} has {} cells, and the smallest cell, at x = 1, has the size {:.3e}.".format(
+        time, len(cells), smallest))
+    return 0
+
+
+CHECKS = {
+    "supg_nodal_exactness": check_supg_nodal_exactness,
+    "downwind_renumbering": check_downwind_renumbering,
+    "hilbert_renumbering": check_hilbert_renumbering,
+    "sell_c_sigma": check_sell_c_sigma,
+    "residual_estimator_refines_layer": check_residual_estimator_refines_layer,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--peclet", required=True, help="Path to the peclet executable")
+    parser.add_argument("--case", required=True, help="Path to the parameter file of the case")
+    parser.add_argument("--check", required=True, choices=sorted(CHECKS.keys()), help="The property to check")
+    parser.add_argument("--work-dir", required=True, help="Directory in which to run the case")
+    args = parser.parse_args()
+
+    with open(args.case) as file:
+        case = file.read()
+
+    return CHECKS[args.check](args.peclet, case, os.path.abspath(args.work_dir))
+
+
+if __name__ == "__main__":
+    sys.exit(main())
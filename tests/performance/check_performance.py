@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+"""Performance regression test of one regression test case.
+
+Runs peclet on the test's parameter file with the instrumentation enabled, on one thread,
+derives deterministic cost metrics from the instrumentation summary, and compares them to
+a stored baseline. The test fails if any metric exceeds its baseline by more than its
+relative tolerance. Improvements beyond the tolerance are reported, so that the baseline
+can be tightened.
+
+Wall time is deliberately not a metric, since it depends on the machine. The peak resident set size
+depends on the machine and the allocator, so it is reported but not gated.
+
+A case without a baseline, or whose baseline lacks one of the gated metrics, fails,
+so that new cases and metrics cannot silently go untested. Record or update a baseline with --update.
+"""
+import argparse
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+"""Relative tolerances of the metrics, unless the baseline file specifies others"""
+DEFAULT_TOLERANCES = {
+    "time_steps": 0.,
+    "krylov_iterations_per_step": 0.05,
+    "max_krylov_iterations": 0.1,
+    "matrix_assemblies": 0.,
+    "assembled_cells": 0.,
+    "allocations": 0.05,
+    "allocated_bytes": 0.05,
+    "bytes_written": 0.01,
+}
+
+"""Metrics which are printed for information, but never fail the test"""
+REPORTED_METRICS = ["peak_resident_bytes"]
+
+OVERRIDES = """
+# Overrides of the performance regression test
+subsection profiling
+    set enabled = true
+    set summary_file_path = profile.json
+    set summary_format = json
+end
+"""
+
+
+def sum_counters(counters, name, field):
+    """Aggregate a counter over every timer scope in which it was recorded"""
+    values = [counter[field] for path, counter in counters.items() if path.split("/")[-1] == name]
+    if not values:
+        return 0.
+    if field == "max":
+        return max(values)
+    return sum(values)
+
+
+def sum_timer_counts(timers, name):
+    return sum(timer["count"] for path, timer in timers.items() if path.split("/")[-1] == name)
+
+
+def measure(peclet, case_file_path, work_dir):
+    if os.path.isdir(work_dir):
+        shutil.rmtree(work_dir)
+    os.makedirs(work_dir)
+
+    with open(case_file_path) as file:
+        case = file.read()
+
+    with open(os.path.join(work_dir, "case.prm"), "w") as file:
+        file.write(case + OVERRIDES)
+
+    environment = dict(os.environ, DEAL_II_NUM_THREADS="1", OMP_NUM_THREADS="1")
+
+    with open(os.path.join(work_dir, "stdout.txt"), "w") as stdout:
+        subprocess.check_call([os.path.abspath(peclet), "case.prm"],
+            cwd=work_dir, env=environment, stdout=stdout, stderr=subprocess.STDOUT)
+
+    with open(os.path.join(work_dir, "profile.json")) as file:
+        profile = json.load(file)
+
+    timers = profile["timers"]
+    counters = profile["counters"]
+
+    solves = sum_counters(counters, "solver_iterations", "count")
+
+    return {
+        "time_steps": sum_timer_counts(timers, "time_step"),
+        "krylov_iterations_per_step":
+            sum_counters(counters, "solver_iterations", "sum")/solves if solves > 0 else 0.,
+        "max_krylov_iterations": sum_counters(counters, "solver_iterations", "max"),
+        "matrix_assemblies": sum_timer_counts(timers, "assemble_matrices"),
+        "assembled_cells": sum_counters(counters, "assembled_cells", "sum"),
+        "allocations": sum_counters(counters, "allocations", "sum"),
+        "allocated_bytes": sum_counters(counters, "allocated_bytes", "sum"),
+        "bytes_written": sum_counters(counters, "bytes_written", "sum"),
+        "peak_resident_bytes": sum_counters(counters, "peak_resident_bytes", "max"),
+    }
+
+
+def compare(metrics, baseline):
+    """Return the list of regressions, and print every metric"""
+    tolerances = dict(DEFAULT_TOLERANCES, **baseline.get("tolerances", {}))
+    regressions = []
+    print("{:>28} {:>16} {:>16} {:>10}".format("metric", "baseline", "measured", "tolerance"))
+    for name, value in sorted(metrics.items()):
+        if name in REPORTED_METRICS:
+            print("{:>28} {:>16} {:>16.6g} {:>10} {}".format(name, "-", value, "-", "not gated"))
+            continue
+        if name not in baseline["metrics"]:
+            print("{:>28} {:>16} {:>16.6g} {:>10} {}".format(name, "-", value, "-", "NO BASELINE"))
+            regressions.append(name)
+            continue
+        reference = baseline["metrics"][name]
+        tolerance = tolerances[name]
+        limit = reference*(1. + tolerance)
+        status = ""
+        if value > limit:
+            status = "REGRESSION"
+            regressions.append(name)
+        elif value < reference*(1. - tolerance):
+            status = "improved; consider updating the baseline"
+        print("{:>28} {:>16.6g} {:>16.6g} {:>10.3g} {}".format(name, reference, value, tolerance, status))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--peclet", required=True, help="Path to the peclet executable")
+    parser.add_argument("--case", required=True, help="Path to the test's parameter file")
+    parser.add_argument("--baseline", required=True, help="Path to the baseline JSON file")
+    parser.add_argument("--work-dir", required=True, help="Directory in which to run the case")
+    parser.add_argument("--update", action="store_true", help="Write the measured metrics as the new baseline")
+    args = parser.parse_args()
+
+    if args.update:
+        metrics = {name: value for name, value in measure(args.peclet, args.case, args.work_dir).items()
+            if name not in REPORTED_METRICS}
+        tolerances = {}
+        if os.path.isfile(args.baseline):
+            with open(args.baseline) as file:
+                tolerances = json.load(file).get("tolerances", {})
+        with open(args.baseline, "w") as file:
+            json.dump({"metrics": metrics, "tolerances": tolerances}, file, indent=2, sort_keys=True)
+            file.write("\n")
+        print("Wrote the baseline " + args.baseline)
+        return 0
+
+    if not os.path.isfile(args.baseline):
+        print("There is no baseline " + args.baseline + ". Record it with make update_performance_baselines.")
+        return 1
+
+    metrics = measure(args.peclet, args.case, args.work_dir)
+
+    with open(args.baseline) as file:
+        baseline = json.load(file)
+
+    regressions = compare(metrics, baseline)
+
+    missing = [name for name in regressions if name not in baseline["metrics"]]
+    if missing:
+        print("The baseline " + args.baseline + " has no value of: " + ", ".join(missing)
+            + ". Record it with make update_performance_baselines.")
+
+    if regressions:
+        print("Performance regression in: " + ", ".join(regressions))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+"""Restart regression test of a 1D case, which runs peclet more than once and compares the runs.
+
+field: Run the case, which writes its final solution to a restart file. Then run the case again,
+with that restart file as its initial values, i.e. initial_values.function_name = interpolate_old_field.
+The grids are the same, so the initial values of the second run must equal the final solution of the first
+bit for bit. Both are read from the 1D solution histories, so the case must write its final time step.
+
+resume: Run the case with periodic checkpoints and adaptive refinement, and then resume it with --resume
+from its last checkpoint. The resumed run must print the same output after the checkpoint's time step,
+and write the same 1D solution history and restart file, as the run which was not interrupted.
+The case must print every time step.
+"""
+import argparse
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+
+HISTORY_1D_MAGIC = b"PECLET1D"
+
+HISTORY_1D_FILE_NAME = "1D_solution_history.bin"
+
+"""The default restart file of case.prm"""
+FIELD_FILE_NAME = "case.restart"
+
+FIELD_OVERRIDES = """
+# Overrides of the restart regression test
+subsection initial_values
+    set function_name = interpolate_old_field
+    set old_field_file_path = {}
+end
+"""
+
+RESUME_OVERRIDES = """
+# Overrides of the restart regression test
+subsection checkpoint
+    set interval = 3
+end
+subsection refinement
+    subsection adaptive
+        set interval = 2
+        set cycles_at_interval = 1
+        set max_level = 8
+    end
+end
+"""
+
+
+def run(peclet, work_dir, arguments):
+    """Run peclet in the work directory, and return its standard output"""
+    result = subprocess.run([os.path.abspath(peclet)] + arguments,
+        cwd=work_dir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    print(result.stdout)
+    result.check_returncode()
+    return result.stdout
+
+
+def write_case(work_dir, case, overrides=""):
+    if os.path.isdir(work_dir):
+        shutil.rmtree(work_dir)
+    os.makedirs(work_dir)
+    with open(os.path.join(work_dir, "case.prm"), "w") as file:
+        file.write(case + overrides)
+
+
+def read_history_1D(file_path):
+    """Return the records of a 1D solution history as (time, positions, values), see solution_history_1D.h"""
+    with open(file_path, "rb") as file:
+        data = file.read()
+    if data[:len(HISTORY_1D_MAGIC)] != HISTORY_1D_MAGIC:
+        raise RuntimeError("Not a 1D solution history file: " + file_path)
+    records = []
+    offset = len(HISTORY_1D_MAGIC) + 4
+    while offset + 16 <= len(data):
+        time, count = struct.unpack_from("<dQ", data, offset)
+        offset += 16
+        if offset + 16*count > len(data):
+            break
+        positions = struct.unpack_from("<{}d".format(count), data, offset)
+        values = struct.unpack_from("<{}d".format(count), data, offset + 8*count)
+        offset += 16*count
+        records.append((time, positions, values))
+    return records
+
+
+def check_field(peclet, case, work_dir):
+    write_dir = os.path.join(work_dir, "write")
+    write_case(write_dir, case)
+    run(peclet, write_dir, ["case.prm"])
+
+    read_dir = os.path.join(work_dir, "read")
+    write_case(read_dir, case, FIELD_OVERRIDES.format(os.path.join(write_dir, FIELD_FILE_NAME)))
+    run(peclet, read_dir, ["case.prm"])
+
+    written = read_history_1D(os.path.join(write_dir, HISTORY_1D_FILE_NAME))[-1]
+    restored = read_history_1D(os.path.join(read_dir, HISTORY_1D_FILE_NAME))[0]
+
+    if (written[1] != restored[1]) or (written[2] != restored[2]):
+        print("The initial values which were read from the restart file differ from the final solution"
+            " at t = {} which was written to it.".format(written[0]))
+        return 1
+
+    print("The restart file reproduced the final solution at t = {}.".format(written[0]))
+    return 0
+
+
+def read_bytes(file_path):
+    with open(file_path, "rb") as file:
+        return file.read()
+
+
+def check_resume(peclet, case, work_dir):
+    write_case(work_dir, case, RESUME_OVERRIDES)
+    uninterrupted_output = run(peclet, work_dir, ["case.prm"]).splitlines()
+    uninterrupted_files = {name: read_bytes(os.path.join(work_dir, name))
+        for name in [HISTORY_1D_FILE_NAME, FIELD_FILE_NAME]}
+
+    resumed_output = run(peclet, work_dir, ["--resume", "case.prm"]).splitlines()
+
+    resumed = [index for index, line in enumerate(resumed_output) if line.startswith("Resumed from ")]
+    if not resumed:
+        print("The resumed run did not report its checkpoint.")
+        return 1
+    step = int(re.match(r"Resumed from .* at time step (\d+),", resumed_output[resumed[0]]).group(1))
+
+    next_step = "Time step {} at t=".format(step + 1)
+    continued = [index for index, line in enumerate(uninterrupted_output) if line.startswith(next_step)]
+    if not continued:
+        print("The run which was not interrupted did not print time step {}.".format(step + 1))
+        return 1
+
+    failures = []
+    if resumed_output[resumed[0] + 1:] != uninterrupted_output[continued[0]:]:
+        failures.append("the output after time step {}".format(step))
+    for name, data in sorted(uninterrupted_files.items()):
+        if read_bytes(os.path.join(work_dir, name)) != data:
+            failures.append(name)
+
+    if failures:
+        print("Resuming from time step {} changed ".format(step) + ", ".join(failures) + ".")
+        return 1
+
+    print("Resuming from time step {} reproduced the run which was not interrupted.".format(step))
+    return 0
+
+
+CHECKS = {"field": check_field, "resume": check_resume}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--peclet", required=True, help="Path to the peclet executable")
+    parser.add_argument("--case", required=True, help="Path to the parameter file of a 1D case")
+    parser.add_argument("--check", required=True, choices=sorted(CHECKS.keys()), help="The restart to check")
+    parser.add_argument("--work-dir", required=True, help="Directory in which to run the case")
+    args = parser.parse_args()
+
+    with open(args.case) as file:
+        case = file.read()
+
+    return CHECKS[args.check](args.peclet, case, os.path.abspath(args.work_dir))
+
+
+if __name__ == "__main__":
+    sys.exit(main())